@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "allocator.h"
+
+namespace rdma {
+
+SlabAllocator::SlabAllocator(Context &ctx) : ctx(&ctx)
+{
+    memset(this->central, 0, sizeof(this->central));
+    memset(this->central_count, 0, sizeof(this->central_count));
+    memset(this->caches, 0, sizeof(this->caches));
+}
+
+SlabAllocator::~SlabAllocator()
+{
+    for (ibv_mr *mr : this->chunks) {
+        void *chunk = mr->addr;
+        this->ctx->dereg_private_mr(mr);
+        ::free(chunk);
+    }
+}
+
+void *SlabAllocator::alloc(size_t size)
+{
+    if (__glibc_unlikely(size > MaxBlockSize))
+        return nullptr;
+
+    int c = size_class(size);
+    int slot = thread_slot();
+    if (__glibc_unlikely(slot < 0)) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->alloc_central(c);
+    }
+
+    ThreadCache &cache = this->caches[slot];
+    if (__glibc_unlikely(cache.head[c] == nullptr)) {
+        // Refill a batch from the central free-list
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (int i = 0; i < BatchSize; ++i) {
+            void *block = this->alloc_central(c);
+            if (block == nullptr)
+                break;
+            next_of(block) = cache.head[c];
+            cache.head[c] = block;
+            cache.count[c]++;
+        }
+        if (cache.head[c] == nullptr)
+            return nullptr;
+    }
+
+    void *block = cache.head[c];
+    cache.head[c] = next_of(block);
+    cache.count[c]--;
+    return block;
+}
+
+void SlabAllocator::free(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+
+    auto header =
+        reinterpret_cast<ChunkHeader *>(reinterpret_cast<uintptr_t>(ptr) & ~(ChunkSize - 1));
+    int c = header->size_class;
+    int slot = thread_slot();
+    if (__glibc_unlikely(slot < 0)) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->free_central(ptr, c);
+        return;
+    }
+
+    ThreadCache &cache = this->caches[slot];
+    next_of(ptr) = cache.head[c];
+    cache.head[c] = ptr;
+    cache.count[c]++;
+
+    if (__glibc_unlikely(cache.count[c] > 2 * BatchSize)) {
+        // Return a batch to the central free-list
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (int i = 0; i < BatchSize; ++i) {
+            void *block = cache.head[c];
+            cache.head[c] = next_of(block);
+            cache.count[c]--;
+            this->free_central(block, c);
+        }
+    }
+}
+
+int SlabAllocator::reserve(size_t size, size_t count)
+{
+    if (size > MaxBlockSize)
+        return -1;
+
+    int c = size_class(size);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    while (this->central_count[c] < count)
+        if (this->grow(c) != 0)
+            return -1;
+    return 0;
+}
+
+int SlabAllocator::thread_slot()
+{
+    static std::atomic<int> nthreads(0);
+    thread_local int slot = nthreads.fetch_add(1);
+    return slot < Consts::MaxThreads ? slot : -1;
+}
+
+void *SlabAllocator::alloc_central(int c)
+{
+    if (this->central[c] == nullptr && this->grow(c) != 0)
+        return nullptr;
+
+    void *block = this->central[c];
+    this->central[c] = next_of(block);
+    this->central_count[c]--;
+    return block;
+}
+
+void SlabAllocator::free_central(void *block, int c)
+{
+    next_of(block) = this->central[c];
+    this->central[c] = block;
+    this->central_count[c]++;
+}
+
+int SlabAllocator::grow(int c)
+{
+    void *chunk = aligned_alloc(ChunkSize, ChunkSize);
+    if (chunk == nullptr)
+        return -1;
+    // Privately: slab chunks are local-only and must not take user-visible MR IDs
+    ibv_mr *mr = this->ctx->reg_private_mr(chunk, ChunkSize);
+    if (mr == nullptr) {
+        ::free(chunk);
+        return -1;
+    }
+    this->chunks.push_back(mr);
+
+    reinterpret_cast<ChunkHeader *>(chunk)->size_class = c;
+    size_t block_size = class_size(c);
+    for (size_t off = ChunkSize - block_size; off >= MinBlockSize; off -= block_size)
+        this->free_central(reinterpret_cast<char *>(chunk) + off, c);
+    return 0;
+}
+
+}  // namespace rdma
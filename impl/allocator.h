@@ -0,0 +1,105 @@
+#if !defined(__ALLOCATOR_H__)
+#define __ALLOCATOR_H__
+
+#include <mutex>
+
+#include "context.h"
+
+namespace rdma {
+
+/**
+ * @brief Allocator of RDMA-registered buffers, owned by a Context.
+ * Memory is registered in large chunks, each dedicated to one power-of-two size class from
+ * `MinBlockSize` (one cache line) to `MaxBlockSize`. Blocks are cache-line-aligned.
+ *
+ * Each thread owns a free-list per size class, so allocation and free from it neither lock nor
+ * register. Blocks move between a thread's free-lists and the central free-lists in batches of
+ * `BatchSize` under a mutex, and a new chunk is registered when the central free-list of a size
+ * class runs dry; `reserve` registers upfront so that this never happens on the hot path.
+ * Threads beyond the first `Consts::MaxThreads` are served from the central free-lists directly.
+ * Thread slots are never recycled, so use long-lived worker threads.
+ *
+ * Chunks are registered privately (see `Context::reg_private_mr`): they take no MR IDs and are
+ * local-only, so peers cannot access blocks. Use `Context::reg_mr` for remotely accessible
+ * memory.
+ */
+class SlabAllocator {
+    friend class Context;
+
+  public:
+    /**
+     * @brief Size (and alignment) of a registered chunk.
+     */
+    static const size_t ChunkSize = 64ul << 20;
+
+    /**
+     * @brief Size of the smallest size class.
+     */
+    static const size_t MinBlockSize = 64;
+
+    /**
+     * @brief Size of the largest size class. Larger allocations fail.
+     */
+    static const size_t MaxBlockSize = 1ul << 20;
+
+    /**
+     * @brief Number of power-of-two size classes.
+     */
+    static const int NumClasses = 15;
+
+    /**
+     * @brief Number of blocks moved between thread and central free-lists at a time.
+     */
+    static const int BatchSize = 32;
+
+    SlabAllocator(SlabAllocator const &) = delete;
+    SlabAllocator(SlabAllocator &&) = delete;
+
+    void *alloc(size_t size);
+    void free(void *ptr);
+    int reserve(size_t size, size_t count);
+
+  private:
+    explicit SlabAllocator(Context &ctx);
+    ~SlabAllocator();
+
+    // Lives in the first cache line of every chunk, blocks start after it
+    struct ChunkHeader {
+        int size_class;
+    };
+
+    struct alignas(64) ThreadCache {
+        void *head[NumClasses];
+        int count[NumClasses];
+    };
+
+    static inline int size_class(size_t size)
+    {
+        if (size <= MinBlockSize)
+            return 0;
+        return 64 - __builtin_clzl(size - 1) - 6;  // log2(MinBlockSize) == 6
+    }
+
+    static inline size_t class_size(int c) { return MinBlockSize << c; }
+
+    static inline void *&next_of(void *block) { return *reinterpret_cast<void **>(block); }
+
+    static int thread_slot();
+
+    void *alloc_central(int c);
+    void free_central(void *block, int c);
+    int grow(int c);
+
+    Context *ctx;
+
+    std::mutex mutex;
+    void *central[NumClasses];
+    size_t central_count[NumClasses];
+    std::vector<ibv_mr *> chunks;
+
+    ThreadCache caches[Consts::MaxThreads];
+};
+
+}  // namespace rdma
+
+#endif  // __ALLOCATOR_H__
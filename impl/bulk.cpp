@@ -0,0 +1,110 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "bulk.h"
+
+namespace rdma {
+
+BulkTransfer::BulkTransfer(Peer &peer, std::vector<int> const &rc_ids, size_t chunk_size,
+                           int window)
+    : chunk_size(chunk_size), window(window), active(false), outstanding(0),
+      wc_error(IBV_WC_SUCCESS), post_error(0)
+{
+    for (int id : rc_ids)
+        this->rcs.push_back(&peer.rc(id));
+    this->inflight.assign(this->rcs.size(), 0);
+}
+
+int BulkTransfer::post_read(void *dst, uintptr_t src, size_t size)
+{
+    return this->start(false, dst, src, size);
+}
+
+int BulkTransfer::post_write(uintptr_t dst, void const *src, size_t size)
+{
+    return this->start(true, const_cast<void *>(src), dst, size);
+}
+
+int BulkTransfer::start(bool write, void *local, uintptr_t remote, size_t size)
+{
+    if (this->active)
+        return EBUSY;
+
+    this->active = true;
+    this->write = write;
+    this->local = reinterpret_cast<char *>(local);
+    this->remote = remote;
+    this->size = size;
+    this->next_offset = 0;
+    this->next_rc = 0;
+    this->wc_error = IBV_WC_SUCCESS;
+    this->post_error = 0;
+
+    this->issue();
+    if (this->outstanding == 0)
+        this->active = false;  // Empty, or failed on the first chunk
+    return this->active ? 0 : this->post_error;  // Later failures surface through `ok`
+}
+
+void BulkTransfer::issue()
+{
+    int nrcs = this->rcs.size();
+    int idle = 0;  // Consecutive connections with full windows
+    while (this->ok() && this->next_offset < this->size && idle < nrcs) {
+        int i = this->next_rc;
+        this->next_rc = (this->next_rc + 1) % nrcs;
+        if (this->inflight[i] >= this->window) {
+            ++idle;
+            continue;
+        }
+        idle = 0;
+
+        size_t off = this->next_offset;
+        size_t len = std::min(this->chunk_size, this->size - off);
+        uint64_t wr_id = off / this->chunk_size;
+        int rc = this->write ? this->rcs[i]->post_write(this->remote + off, this->local + off,
+                                                         len, true, wr_id)
+                             : this->rcs[i]->post_read(this->local + off, this->remote + off, len,
+                                                        true, wr_id);
+        if (rc != 0) {
+            this->post_error = rc;
+            break;
+        }
+        this->next_offset += len;
+        this->inflight[i]++;
+        this->outstanding++;
+    }
+}
+
+bool BulkTransfer::poll()
+{
+    if (!this->active)
+        return true;
+
+    ibv_wc wc_arr[16];
+    for (size_t i = 0; i < this->rcs.size(); ++i) {
+        if (this->inflight[i] == 0)
+            continue;
+        int n = this->rcs[i]->poll_send_cq_once(wc_arr, std::min(this->inflight[i], 16));
+        for (int j = 0; j < n; ++j)
+            if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS) &&
+                this->wc_error == IBV_WC_SUCCESS)
+                this->wc_error = wc_arr[j].status;
+        this->inflight[i] -= n;
+        this->outstanding -= n;
+    }
+
+    this->issue();
+    if (this->outstanding == 0 && (!this->ok() || this->next_offset == this->size))
+        this->active = false;
+    return !this->active;
+}
+
+bool BulkTransfer::wait()
+{
+    while (!this->poll())
+        ;
+    return this->ok();
+}
+
+}  // namespace rdma
@@ -0,0 +1,117 @@
+#if !defined(__BULK_H__)
+#define __BULK_H__
+
+#include "rc/rc.h"
+
+namespace rdma {
+
+/**
+ * @brief Engine for large READ/WRITE transfers to one peer.
+ * A transfer is split into chunks of `chunk_size` bytes, posted round-robin over one or more RC
+ * connections with at most `window` chunks in flight on each, so that the NIC always has work
+ * queued and no single WR serializes the transfer. The whole transfer completes once.
+ *
+ * Every chunk is signaled, and the engine polls the send CQs of its connections. Use connections
+ * dedicated to bulk traffic: other completions on their CQs would be consumed by the engine.
+ * Keys are resolved per chunk, so a transfer may span several MRs as long as each chunk lies
+ * inside one (e.g., adjacent MRs whose boundaries are multiples of `chunk_size` apart from the
+ * start of the transfer).
+ * One transfer is in progress at a time.
+ */
+class BulkTransfer {
+  public:
+    /**
+     * @brief Default size of a chunk.
+     */
+    static const size_t DefaultChunkSize = 1ul << 20;
+
+    /**
+     * @brief Default number of chunks in flight on each connection.
+     */
+    static const int DefaultWindow = 4;
+
+    /**
+     * @brief Construct a transfer engine over RC connections to a peer.
+     *
+     * @param peer The remote peer.
+     * @param rc_ids IDs of the RC connections to use.
+     * @param chunk_size Size in bytes of each chunk.
+     * @param window Maximum number of chunks in flight on each connection.
+     */
+    explicit BulkTransfer(Peer &peer, std::vector<int> const &rc_ids = {0},
+                          size_t chunk_size = DefaultChunkSize, int window = DefaultWindow);
+
+    BulkTransfer(BulkTransfer const &) = delete;
+    BulkTransfer(BulkTransfer &&) = delete;
+
+    /**
+     * @brief Start reading `size` bytes from remote `src` into local `dst`.
+     * @return int 0 if started, EBUSY if a transfer is in progress, or the status code returned by
+     * `ibv_post_send` function if no chunk could be posted.
+     */
+    int post_read(void *dst, uintptr_t src, size_t size);
+
+    /**
+     * @brief Start writing `size` bytes from local `src` to remote `dst`.
+     * @return int 0 if started, EBUSY if a transfer is in progress, or the status code returned by
+     * `ibv_post_send` function if no chunk could be posted.
+     */
+    int post_write(uintptr_t dst, void const *src, size_t size);
+
+    /**
+     * @brief Make progress: reap completed chunks and post more.
+     * After a failure, no more chunks are posted, and the transfer ends once the chunks in flight
+     * are reaped.
+     *
+     * @return true If the transfer has ended (see `ok`).
+     */
+    bool poll();
+
+    /**
+     * @brief Make progress until the transfer ends.
+     * @return true If the last transfer succeeded (see `ok`).
+     */
+    bool wait();
+
+    /**
+     * @brief Check whether the last transfer succeeded: every chunk was posted and completed.
+     */
+    inline bool ok() const { return this->wc_error == IBV_WC_SUCCESS && this->post_error == 0; }
+
+    /**
+     * @brief Get the completion status of the first failed chunk of the last transfer.
+     * @return ibv_wc_status IBV_WC_SUCCESS if no chunk completed with an error.
+     */
+    inline ibv_wc_status wc_status() const { return this->wc_error; }
+
+    /**
+     * @brief Get the error of the last transfer in posting a chunk.
+     * @return int 0 if every chunk posted was accepted, else the status code returned by
+     * `ibv_post_send` function.
+     */
+    inline int post_status() const { return this->post_error; }
+
+  private:
+    int start(bool write, void *local, uintptr_t remote, size_t size);
+    void issue();
+
+    std::vector<ReliableConnection *> rcs;
+    std::vector<int> inflight;
+    size_t chunk_size;
+    int window;
+
+    bool active;
+    bool write;
+    char *local;
+    uintptr_t remote;
+    size_t size;
+    size_t next_offset;
+    int next_rc;
+    int outstanding;
+    ibv_wc_status wc_error;
+    int post_error;
+};
+
+}  // namespace rdma
+
+#endif  // __BULK_H__
@@ -0,0 +1,211 @@
+#if !defined(__CHAIN_H__)
+#define __CHAIN_H__
+
+#include <cstring>
+
+#include "rdma_base.h"
+#include "span.h"
+
+namespace rdma {
+
+/**
+ * @brief Builder of a chain of heterogeneous work requests posted with one call (one doorbell).
+ * READ, WRITE, SEND, CAS, FAA and masked atomics can be mixed freely, each with its own wr_id and
+ * flags, and are executed in the order they were added. Post the chain with
+ * `ReliableConnection::post_chain` or `ExtendedReliableConnection::post_chain`.
+ *
+ * `flags` of each WR is a mask of `IBV_EXP_SEND_SIGNALED` (generate a completion) and
+ * `IBV_EXP_SEND_FENCE` (wait for prior READs and atomics of the chain to complete first, e.g. the
+ * release WRITE after a lock-acquire CAS).
+ *
+ * A chain holds at most `Consts::MaxPostWR` WRs; adding more makes posting fail. Keys must be
+ * resolved in advance (see `Context::local_span` and `Peer::remote_span`).
+ */
+class WrChain {
+  public:
+    WrChain() : count(0), overflow(false) {}
+
+    inline WrChain &read(LocalSpan const &dst, RemoteSpan const &src, int flags = 0,
+                         uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr *wr = this->add(dst, IBV_EXP_WR_RDMA_READ, flags, wr_id);
+        if (wr) {
+            wr->wr.rdma.remote_addr = src.addr;
+            wr->wr.rdma.rkey = src.rkey;
+        }
+        return *this;
+    }
+
+    inline WrChain &write(RemoteSpan const &dst, LocalSpan const &src, int flags = 0,
+                          uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr *wr = this->add(src, IBV_EXP_WR_RDMA_WRITE, flags, wr_id);
+        if (wr) {
+            wr->wr.rdma.remote_addr = dst.addr;
+            wr->wr.rdma.rkey = dst.rkey;
+        }
+        return *this;
+    }
+
+    /**
+     * @param remote_id Ignored by RC. With XRC, the ID of the remote XRC end receiving the SEND.
+     */
+    inline WrChain &send(LocalSpan const &src, int flags = 0, uint64_t wr_id = 0,
+                         int remote_id = 0)
+    {
+        if (this->add(src, IBV_EXP_WR_SEND, flags, wr_id))
+            this->remote_ids[this->count - 1] = remote_id;
+        return *this;
+    }
+
+    /**
+     * @param compare Local 8-byte buffer holding the compare value, and receiving the original
+     * remote value.
+     */
+    inline WrChain &cas(RemoteSpan const &dst, LocalSpan const &compare, uint64_t swap,
+                        int flags = 0, uint64_t wr_id = 0)
+    {
+        check_aligned(dst);
+        ibv_exp_send_wr *wr = this->add(compare.sub(0, sizeof(uint64_t)),
+                                        IBV_EXP_WR_ATOMIC_CMP_AND_SWP, flags, wr_id);
+        if (wr) {
+            wr->wr.atomic.remote_addr = dst.addr;
+            wr->wr.atomic.rkey = dst.rkey;
+            wr->wr.atomic.compare_add = *reinterpret_cast<uint64_t *>(compare.addr);
+            wr->wr.atomic.swap = swap;
+        }
+        return *this;
+    }
+
+    /**
+     * @param fetch Local 8-byte buffer receiving the original remote value.
+     */
+    inline WrChain &faa(RemoteSpan const &dst, LocalSpan const &fetch, uint64_t add,
+                        int flags = 0, uint64_t wr_id = 0)
+    {
+        check_aligned(dst);
+        ibv_exp_send_wr *wr = this->add(fetch.sub(0, sizeof(uint64_t)),
+                                        IBV_EXP_WR_ATOMIC_FETCH_AND_ADD, flags, wr_id);
+        if (wr) {
+            wr->wr.atomic.remote_addr = dst.addr;
+            wr->wr.atomic.rkey = dst.rkey;
+            wr->wr.atomic.compare_add = add;
+        }
+        return *this;
+    }
+
+    inline WrChain &masked_cas(RemoteSpan const &dst, LocalSpan const &compare,
+                               uint64_t compare_mask, uint64_t swap, uint64_t swap_mask,
+                               int flags = 0, uint64_t wr_id = 0)
+    {
+        check_aligned(dst);
+        ibv_exp_send_wr *wr =
+            this->add(compare.sub(0, sizeof(uint64_t)), IBV_EXP_WR_EXT_MASKED_ATOMIC_CMP_AND_SWP,
+                      flags | IBV_EXP_SEND_EXT_ATOMIC_INLINE, wr_id);
+        if (wr) {
+            auto &op = wr->ext_op.masked_atomics;
+            op.log_arg_sz = 3;  // log(sizeof(uint64_t))
+            op.remote_addr = dst.addr;
+            op.rkey = dst.rkey;
+            op.wr_data.inline_data.op.cmp_swap.compare_val =
+                *reinterpret_cast<uint64_t *>(compare.addr);
+            op.wr_data.inline_data.op.cmp_swap.compare_mask = compare_mask;
+            op.wr_data.inline_data.op.cmp_swap.swap_val = swap;
+            op.wr_data.inline_data.op.cmp_swap.swap_mask = swap_mask;
+        }
+        return *this;
+    }
+
+    inline WrChain &masked_faa(RemoteSpan const &dst, LocalSpan const &fetch, uint64_t add,
+                               uint64_t boundary, int flags = 0, uint64_t wr_id = 0)
+    {
+        check_aligned(dst);
+        ibv_exp_send_wr *wr =
+            this->add(fetch.sub(0, sizeof(uint64_t)), IBV_EXP_WR_EXT_MASKED_ATOMIC_FETCH_AND_ADD,
+                      flags | IBV_EXP_SEND_EXT_ATOMIC_INLINE, wr_id);
+        if (wr) {
+            auto &op = wr->ext_op.masked_atomics;
+            op.log_arg_sz = 3;  // log(sizeof(uint64_t))
+            op.remote_addr = dst.addr;
+            op.rkey = dst.rkey;
+            op.wr_data.inline_data.op.fetch_add.add_val = add;
+            op.wr_data.inline_data.op.fetch_add.field_boundary = boundary;
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Remove all WRs, so that the chain can be reused.
+     */
+    inline void clear()
+    {
+        this->count = 0;
+        this->overflow = false;
+    }
+
+    inline int size() const { return this->count; }
+
+    /**
+     * @brief Get the i-th WR and its SGE as built, e.g., for inspection. The WR is linked to its
+     * SGE and successor only at post time.
+     */
+    inline ibv_exp_send_wr const &wr_at(int i) const { return this->wrs[i]; }
+    inline ibv_sge const &sge_at(int i) const { return this->sges[i]; }
+
+  private:
+    friend class ReliableConnection;
+    friend class ExtendedReliableConnection;
+
+    static inline void check_aligned(RemoteSpan const &dst)
+    {
+        if (__glibc_unlikely((dst.addr & 0x7) != 0))
+            Emergency::abort("chain atomic to non-aligned address");
+    }
+
+    inline ibv_exp_send_wr *add(LocalSpan const &local, ibv_exp_wr_opcode opcode, int flags,
+                                uint64_t wr_id)
+    {
+        if (__glibc_unlikely(this->count == Consts::MaxPostWR)) {
+            this->overflow = true;
+            return nullptr;
+        }
+
+        int i = this->count++;
+        this->sges[i].addr = local.uaddr();
+        this->sges[i].length = local.size;
+        this->sges[i].lkey = local.lkey;
+
+        ibv_exp_send_wr *wr = &this->wrs[i];
+        memset(wr, 0, sizeof(ibv_exp_send_wr));
+        wr->wr_id = wr_id;
+        wr->num_sge = 1;
+        wr->exp_opcode = opcode;
+        wr->exp_send_flags = flags;
+        return wr;
+    }
+
+    /**
+     * @brief Link the WRs and their SGEs, returning the head (nullptr if empty or overflowed).
+     * Done at post time, so that the chain stays valid when copied.
+     */
+    inline ibv_exp_send_wr *link()
+    {
+        if (this->count == 0 || this->overflow)
+            return nullptr;
+        for (int i = 0; i < this->count; ++i) {
+            this->wrs[i].sg_list = &this->sges[i];
+            this->wrs[i].next = (i == this->count - 1 ? nullptr : &this->wrs[i + 1]);
+        }
+        return this->wrs;
+    }
+
+    int count;
+    bool overflow;
+    ibv_exp_send_wr wrs[Consts::MaxPostWR];
+    ibv_sge sges[Consts::MaxPostWR];
+    int remote_ids[Consts::MaxPostWR];
+};
+
+}  // namespace rdma
+
+#endif  // __CHAIN_H__
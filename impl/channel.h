@@ -0,0 +1,128 @@
+#if !defined(__CHANNEL_H__)
+#define __CHANNEL_H__
+
+#include <fcntl.h>
+#include <poll.h>
+#include <chrono>
+
+#include "rdma_base.h"
+
+namespace rdma {
+
+/**
+ * @brief A completion channel bound to one CQ, for waiting without spinning.
+ * Its fd is non-blocking, so it can be watched with epoll/poll, and it becomes readable when the
+ * CQ, once armed, receives a completion. Owned by the connection that owns the CQ.
+ */
+class CompletionChannel {
+  public:
+    /**
+     * @brief Default spinning budget of `wait`, in microseconds.
+     */
+    static const int DefaultSpinUs = 50;
+
+    CompletionChannel() : channel(nullptr) {}
+
+    /**
+     * @brief Create the channel. Dies on failure.
+     */
+    inline void open(ibv_context *ctx)
+    {
+        this->channel = ibv_create_comp_channel(ctx);
+        if (this->channel == nullptr)
+            Emergency::abort("failed to create completion channel");
+        int flags = fcntl(this->channel->fd, F_GETFL);
+        if (fcntl(this->channel->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+            Emergency::abort("failed to make completion channel non-blocking");
+    }
+
+    /**
+     * @brief Destroy the channel, after its CQ has been destroyed.
+     */
+    inline void close()
+    {
+        if (this->channel)
+            ibv_destroy_comp_channel(this->channel);
+        this->channel = nullptr;
+    }
+
+    inline ibv_comp_channel *get() const { return this->channel; }
+
+    inline int fd() const { return this->channel ? this->channel->fd : -1; }
+
+    /**
+     * @brief Poll a CQ, spinning for up to `spin_us` microseconds, then sleeping on this channel
+     * until a completion arrives or `timeout_ms` milliseconds (-1 for no limit) have passed.
+     * Without a channel, keeps spinning instead. With `spin_us == 0` and `timeout_ms == 0`, it
+     * never blocks, and leaves the CQ armed when nothing was polled.
+     *
+     * @param cq The CQ bound to this channel.
+     * @param poll_once Polls the CQ once, as `int(ibv_wc *, int)`.
+     * @return int Number of completions polled, 0 on timeout.
+     */
+    template <typename PollOnce>
+    inline int wait(ibv_cq *cq, PollOnce &&poll_once, ibv_wc *wc_arr, int n, int spin_us,
+                    int timeout_ms)
+    {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        auto spin_end = start + std::chrono::microseconds(spin_us);
+        auto deadline = start + std::chrono::milliseconds(timeout_ms);
+
+        int res;
+        do {
+            res = poll_once(wc_arr, n);
+            if (res != 0)
+                return res;
+        } while (clock::now() < spin_end);
+
+        for (;;) {
+            if (this->channel == nullptr) {
+                res = poll_once(wc_arr, n);
+            }
+            else {
+                // Arm, then poll again, so that a completion racing with arming is not missed
+                this->drain();
+                if (ibv_req_notify_cq(cq, 0))
+                    Emergency::abort("failed to arm CQ");
+                res = poll_once(wc_arr, n);
+                if (res == 0 && timeout_ms != 0 && this->sleep(remaining_ms(deadline, timeout_ms)))
+                    res = poll_once(wc_arr, n);
+            }
+            if (res != 0 || (timeout_ms >= 0 && clock::now() >= deadline))
+                return res;
+        }
+    }
+
+  private:
+    // Consume and acknowledge the events delivered so far, without blocking
+    inline void drain()
+    {
+        ibv_cq *cq;
+        void *cq_ctx;
+        while (ibv_get_cq_event(this->channel, &cq, &cq_ctx) == 0)
+            ibv_ack_cq_events(cq, 1);
+    }
+
+    // Wait for the fd to become readable
+    inline bool sleep(int timeout_ms)
+    {
+        pollfd pfd = {this->channel->fd, POLLIN, 0};
+        return ::poll(&pfd, 1, timeout_ms) > 0;
+    }
+
+    static inline int remaining_ms(std::chrono::steady_clock::time_point deadline, int timeout_ms)
+    {
+        if (timeout_ms < 0)
+            return -1;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        return left.count() > 0 ? left.count() : 0;
+    }
+
+    ibv_comp_channel *channel;
+};
+
+}  // namespace rdma
+
+#endif  // __CHANNEL_H__
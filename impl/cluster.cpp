@@ -1,22 +1,36 @@
 #include <mpi.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 
 #include "cluster.h"
 #include "context.h"
 #include "peer.h"
+#include "shared_cq.h"
 
 namespace rdma {
 
-Cluster::Cluster(Context &ctx) : connected(false)
+Cluster::Cluster(Context &ctx)
+    : connected(false), max_inline(0), cq_channels(false), cq_timestamps(false),
+      mr_wait_us(1000000), num_published(0)
 {
     int rc;
-    rc = MPI_Comm_size(MPI_COMM_WORLD, &this->n);
+    rc = MPI_Query_thread(&this->mpi_thread_level);
+    if (rc != MPI_SUCCESS) {
+        Emergency::abort("cannot query MPI thread support level");
+    }
+
+    rc = MPI_Comm_dup(MPI_COMM_WORLD, &this->comm);
+    if (rc != MPI_SUCCESS) {
+        Emergency::abort("cannot duplicate MPI_COMM_WORLD");
+    }
+
+    rc = MPI_Comm_size(this->comm, &this->n);
     if (rc != MPI_SUCCESS) {
         Emergency::abort("cannot get MPI_Comm_size");
     }
 
-    rc = MPI_Comm_rank(MPI_COMM_WORLD, &this->id);
+    rc = MPI_Comm_rank(this->comm, &this->id);
     if (rc != MPI_SUCCESS) {
         Emergency::abort("cannot get MPI_Comm_rank");
     }
@@ -26,6 +40,7 @@ Cluster::Cluster(Context &ctx) : connected(false)
     this->ctx = &ctx;
 
     // Initiate peers vector
+    this->num_received.assign(this->n, 0);
     this->peers.assign(this->n, nullptr);
     for (int i = 0; i < this->n; ++i) {
         if (i == this->id)
@@ -36,12 +51,37 @@ Cluster::Cluster(Context &ctx) : connected(false)
 
 Cluster::~Cluster()
 {
+    {
+        std::lock_guard<std::mutex> lock(this->mpi_mutex);
+
+        // A peer no longer polling never receives our publications, so waiting for them to
+        // complete could hang. Instead, every node receives the ones addressed to it first
+        std::vector<int> num_sent(this->n);
+        MPI_Allgather(&this->num_published, 1, MPI_INT, num_sent.data(), 1, MPI_INT, this->comm);
+        for (int i = 0; i < this->n; ++i) {
+            for (int j = this->num_received[i]; j < num_sent[i]; ++j) {
+                ibv_mr mr;
+                MPI_Recv(&mr, sizeof(ibv_mr), MPI_BYTE, i, MrPublishTag, this->comm,
+                         MPI_STATUS_IGNORE);
+            }
+        }
+        MPI_Waitall(this->publish_reqs.size(), this->publish_reqs.data(), MPI_STATUSES_IGNORE);
+        this->publish_reqs.clear();
+        this->publish_bufs.clear();
+    }
+
     for (int i = 0; i < this->n; ++i) {
         if (this->peers[i])
             delete this->peers[i];
     }
     this->peers.clear();
 
+    // After the QPs on them are gone
+    for (SharedCq *cq : this->shared_cqs)
+        delete cq;
+    this->shared_cqs.clear();
+    MPI_Comm_free(&this->comm);
+
     // Dereference the RDMA context
     this->ctx->refcnt.fetch_sub(1);
 }
@@ -59,7 +99,7 @@ void Cluster::establish(int num_rc, int num_xrc)
         return;
 
     // Before proceeding, barrier to ensure all peers are ready
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(this->comm);
 
     // Establish connection
     for (int i = 0; i < this->n; ++i) {
@@ -69,7 +109,7 @@ void Cluster::establish(int num_rc, int num_xrc)
     }
 
     // Now all connections has been established, barrier
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(this->comm);
 }
 
 void Cluster::establish(int num_rc, int *share_cq_with)
@@ -84,7 +124,7 @@ void Cluster::establish(int num_rc, int *share_cq_with)
         return;
 
     // Before proceeding, barrier to ensure all peers are ready
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(this->comm);
 
     // Establish connection
     for (int i = 0; i < this->n; ++i) {
@@ -94,15 +134,155 @@ void Cluster::establish(int num_rc, int *share_cq_with)
     }
 
     // Now all connections has been established, barrier
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(this->comm);
+}
+
+void Cluster::establish(int num_rc, CqSharing sharing)
+{
+    if (sharing == CqSharing::PerConnection) {
+        // Named, so that a bare 0 cannot pick the `int *` overload as a null pointer
+        int num_xrc = 0;
+        this->establish(num_rc, num_xrc);
+        return;
+    }
+    if (num_rc <= 0) {
+        Emergency::abort("no connections to establish");
+    }
+
+    // Allow only once
+    bool _connected = false;
+    if (!this->connected.compare_exchange_strong(_connected, true))
+        return;
+
+    // Create the shared CQs, deep enough for the send queues of all peers (and never empty, even
+    // on a single node)
+    int cq_depth = std::max(
+        1, std::min((this->n - 1) * Consts::MaxQueueDepth, this->ctx->device_attr.max_cqe));
+    for (int i = 0; i < num_rc; ++i)
+        this->shared_cqs.push_back(
+            new SharedCq(*this->ctx, i, cq_depth, this->cq_channels, this->cq_timestamps));
+
+    // Before proceeding, barrier to ensure all peers are ready
+    MPI_Barrier(this->comm);
+
+    // Establish connection
+    for (int i = 0; i < this->n; ++i) {
+        if (i == this->id)
+            continue;
+        this->peers[i]->establish(num_rc, this->shared_cqs);
+    }
+
+    // Now all connections has been established, barrier
+    MPI_Barrier(this->comm);
+}
+
+void Cluster::set_max_inline(int bytes)
+{
+    if (bytes < 0 || bytes > Consts::MaxInlineData)
+        Emergency::abort("invalid inline capacity: " + std::to_string(bytes));
+    this->max_inline = bytes;
+}
+
+void Cluster::set_cq_channels(bool enable) { this->cq_channels = enable; }
+
+void Cluster::set_mr_wait(int timeout_us)
+{
+    if (timeout_us < 0)
+        Emergency::abort("invalid MR wait timeout: " + std::to_string(timeout_us));
+    this->mr_wait_us.store(timeout_us, std::memory_order_relaxed);
+}
+
+bool Cluster::may_call_mpi() const
+{
+    if (this->mpi_thread_level == MPI_THREAD_MULTIPLE)
+        return true;
+    // With MPI_THREAD_SERIALIZED, the application may be in MPI on another thread right now
+    if (this->mpi_thread_level == MPI_THREAD_SERIALIZED)
+        return false;
+    int main = 0;
+    MPI_Is_thread_main(&main);
+    return main;
+}
+
+void Cluster::set_cq_timestamps(bool enable)
+{
+    if (enable && !this->ctx->clock.supported())
+        Emergency::abort("NIC does not support completion timestamps");
+    this->cq_timestamps = enable;
 }
 
 void Cluster::sync()
 {
-    int rc = MPI_Barrier(MPI_COMM_WORLD);
+    int rc = MPI_Barrier(this->comm);
     if (rc != MPI_SUCCESS)
         Emergency::abort("failed to sync");
     asm volatile("" ::: "memory");
 }
 
+void Cluster::publish_mr(int mr_id)
+{
+    if (!this->connected.load())
+        return;
+
+    std::lock_guard<std::mutex> lock(this->mpi_mutex);
+
+    // Reclaim buffers of finished publications
+    int done = 0;
+    MPI_Testall(this->publish_reqs.size(), this->publish_reqs.data(), &done, MPI_STATUSES_IGNORE);
+    if (done) {
+        this->publish_reqs.clear();
+        this->publish_bufs.clear();
+    }
+
+    ibv_mr *mr;
+    {
+        std::lock_guard<std::mutex> mr_lock(this->ctx->mr_mutex);
+        if (this->ctx->mrs[mr_id] == nullptr)
+            Emergency::abort("cannot publish dropped memory region " + std::to_string(mr_id));
+        mr = new ibv_mr(*this->ctx->mrs[mr_id]);
+    }
+    this->publish_bufs.emplace_back(mr);
+
+    for (int i = 0; i < this->n; ++i) {
+        if (i == this->id)
+            continue;
+        MPI_Request req;
+        int rc = MPI_Isend(mr, sizeof(ibv_mr), MPI_BYTE, i, MrPublishTag, this->comm, &req);
+        if (rc != MPI_SUCCESS)
+            Emergency::abort("cannot publish MR to peer " + std::to_string(i));
+        this->publish_reqs.push_back(req);
+    }
+    ++this->num_published;
+}
+
+int Cluster::poll_mr_updates()
+{
+    std::lock_guard<std::mutex> lock(this->mpi_mutex);
+
+    // Gather per peer, so that each peer takes its MR lock once for the whole batch
+    std::vector<std::vector<ibv_mr>> received;
+    int count = 0;
+    while (true) {
+        int flag;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MrPublishTag, this->comm, &flag, &status);
+        if (!flag)
+            break;
+
+        ibv_mr mr;
+        MPI_Recv(&mr, sizeof(ibv_mr), MPI_BYTE, status.MPI_SOURCE, MrPublishTag, this->comm,
+                 MPI_STATUS_IGNORE);
+        if (received.empty())
+            received.resize(this->n);
+        received[status.MPI_SOURCE].push_back(mr);
+        ++this->num_received[status.MPI_SOURCE];
+        ++count;
+    }
+
+    for (size_t i = 0; i < received.size(); ++i)
+        if (!received[i].empty())
+            this->peers[i]->add_remote_mrs(received[i].data(), received[i].size());
+    return count;
+}
+
 }  // namespace rdma
@@ -1,10 +1,21 @@
 #if !defined(__CLUSTER_H__)
 #define __CLUSTER_H__
 
+#include <memory>
+#include <mutex>
+
 #include "rdma_base.h"
 
 namespace rdma {
 
+/**
+ * @brief Policy of CQ sharing among the RC connections created by `Cluster::establish`.
+ */
+enum class CqSharing {
+    PerConnection,  // Each connection has its own send CQ and recv CQ
+    PerThread,      // Connection i to every peer shares one send CQ and one recv CQ
+};
+
 /**
  * @brief Represents the whole RDMA cluster.
  * A pseudo-singleton design pattern is adopted to prevent the user from
@@ -14,12 +25,19 @@ class Cluster {
     friend class Context;
     friend class Peer;
     friend class ReliableConnection;
+    friend class ExtendedReliableConnection;
 
   public:
     /**
      * @brief Construct a Cluster object basing on an RDMA context.
      * The construction is allowed for only once. Further attempts will kill the process.
      *
+     * Multiple clusters (e.g., one per RDMA NIC) may coexist, as each of them communicates
+     * over its own duplicate of MPI_COMM_WORLD. All nodes must construct them in the same order.
+     *
+     * The thread support level MPI was initialized with is recorded: remote MR lookups that miss
+     * only receive publications themselves (see `publish_mr`) where they may call MPI.
+     *
      * @warning MPI context must be already set-up for a Cluster to be constructed.
      */
     explicit Cluster(Context &ctx);
@@ -37,6 +55,8 @@ class Cluster {
 
     /**
      * @brief On destruction, frees up all RDMA connections.
+     * Collective, like the construction: every node first receives the publications addressed to
+     * it that it has not polled, so that no node waits forever for its own to be received.
      */
     ~Cluster();
 
@@ -62,11 +82,95 @@ class Cluster {
      */
     void establish(int num_rc, int *share_cq_with);
 
+    /**
+     * @brief Synchronize among all peers and establish full RDMA RC connections, with CQs shared
+     * according to a policy.
+     * With `CqSharing::PerThread`, connection i to every peer reports into the same CQ pair (see
+     * `shared_cq`), so that the thread using connection i polls one send CQ and one recv CQ
+     * whatever the cluster size. Each CQ holds `(size() - 1) * Consts::MaxQueueDepth` entries, up
+     * to the device limit; keep the completions in flight below its capacity.
+     *
+     * @param num_rc Number of RDMA RC connection(s) to establish.
+     * @param sharing CQ-sharing policy.
+     */
+    void establish(int num_rc, CqSharing sharing);
+
+    /**
+     * @brief Get the CQ pair shared by connection `id` to every peer.
+     * Only valid after `establish` with `CqSharing::PerThread`.
+     *
+     * @param id The ID of the RDMA RC connections.
+     * @return SharedCq& Object reference representing the CQ pair.
+     */
+    inline SharedCq &shared_cq(int id = 0) const { return *shared_cqs[id]; }
+
+    /**
+     * @brief Set the inline data capacity of QPs created by `establish`.
+     * WRITEs and SENDs of at most this many bytes then carry their data inside the WR, so their
+     * source buffers need not be registered. The device may grant less than requested.
+     * Must be called before `establish`.
+     *
+     * @param bytes Requested inline capacity, at most `Consts::MaxInlineData` (0 disables).
+     */
+    void set_max_inline(int bytes);
+
+    /**
+     * @brief Create a completion channel for each CQ created by `establish`.
+     * Connections can then wait for completions without spinning (see
+     * `ReliableConnection::wait_send_cq`), and expose the channel fds for epoll.
+     * Must be called before `establish`.
+     *
+     * @param enable If true, CQs get completion channels.
+     */
+    void set_cq_channels(bool enable);
+
+    /**
+     * @brief Have the RNIC stamp every completion of the CQs created by `establish`.
+     * The stamps are read with `ReliableConnection::poll_send_cq_timestamped` (or its variants),
+     * which splits the latency of an operation into its time on the network and on the host
+     * without reading the host clock around each post. Dies if the RNIC has no completion clock
+     * (see `Context::hw_clock`). Must be called before `establish`.
+     *
+     * @param enable If true, CQs stamp completions.
+     */
+    void set_cq_timestamps(bool enable);
+
     /**
      * @brief Synchronize among all peers with MPI_Barrier.
      */
     void sync();
 
+    /**
+     * @brief Publish a memory region registered after `establish` to all peers.
+     * The MR is sent over the MPI bootstrap channel without any barrier. Peers pick it up in
+     * `poll_mr_updates`. When a remote address misses all known remote MRs, the posting thread
+     * waits up to `set_mr_wait` for the publication, polling for it itself only if MPI was
+     * initialized with `MPI_THREAD_MULTIPLE`, or if it is the main thread and MPI was initialized
+     * with at most `MPI_THREAD_FUNNELED`. Otherwise, the thread allowed to call MPI must call
+     * `poll_mr_updates` meanwhile. Before `establish`, this is a no-op since all MRs get exchanged
+     * then.
+     *
+     * @param mr_id ID of the memory region returned by `Context::reg_mr` (or its variants).
+     */
+    void publish_mr(int mr_id);
+
+    /**
+     * @brief Receive memory regions published by peers and add them to their remote MR lists.
+     * Must be called from a thread allowed to call MPI at the thread support level MPI was
+     * initialized with.
+     *
+     * @return int Number of memory regions received.
+     */
+    int poll_mr_updates();
+
+    /**
+     * @brief Set how long a remote MR lookup that misses waits for a publication before the
+     * process dies. The wait backs off, sleeping up to a millisecond between attempts.
+     *
+     * @param timeout_us Timeout in microseconds (defaults to one second, 0 fails at once).
+     */
+    void set_mr_wait(int timeout_us);
+
     /**
      * @brief Get the ID of this node.
      *
@@ -91,12 +195,33 @@ class Cluster {
     inline Peer &peer(int id) const { return *peers[id]; }
 
   private:
+    static const int MrPublishTag = 2;
+
+    /**
+     * @brief Whether the calling thread may call MPI, and thus poll for publications itself.
+     */
+    bool may_call_mpi() const;
+
     Context *ctx;
+    MPI_Comm comm;  // Private duplicate of MPI_COMM_WORLD, so that clusters never match messages
     int n;
     int id;
     std::vector<Peer *> peers;
+    std::vector<SharedCq *> shared_cqs;  // Per connection ID, with `CqSharing::PerThread`
 
     std::atomic<bool> connected;
+    int max_inline;
+    bool cq_channels;
+    bool cq_timestamps;
+
+    int mpi_thread_level;
+    std::atomic<int> mr_wait_us;
+
+    std::mutex mpi_mutex;
+    std::vector<MPI_Request> publish_reqs;
+    std::vector<std::unique_ptr<ibv_mr>> publish_bufs;
+    int num_published;              // MRs published to every peer
+    std::vector<int> num_received;  // MRs received from each peer
 };
 
 }  // namespace rdma
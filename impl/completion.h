@@ -0,0 +1,81 @@
+#if !defined(__COMPLETION_H__)
+#define __COMPLETION_H__
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <functional>
+
+#include "rdma_base.h"
+
+namespace rdma {
+
+/**
+ * @brief A completion of a RECV, decoded from `ibv_wc`.
+ * A RECV is consumed either by a SEND (`opcode == IBV_WC_RECV`), or by a WRITE with immediate
+ * (`opcode == IBV_WC_RECV_RDMA_WITH_IMM`), which places no data in the RECV buffer.
+ */
+struct RecvCompletion {
+    uint64_t wr_id;        // wr_id of the RECV
+    ibv_wc_status status;  // IBV_WC_SUCCESS unless failed
+    ibv_wc_opcode opcode;  // IBV_WC_RECV or IBV_WC_RECV_RDMA_WITH_IMM
+    uint32_t byte_len;     // Bytes received (of the WRITE for IBV_WC_RECV_RDMA_WITH_IMM)
+    bool has_imm;          // Whether immediate data came along
+    uint32_t imm;          // Immediate data, in host byte order
+
+    /**
+     * @brief Decode a RECV completion.
+     */
+    static inline RecvCompletion from(ibv_wc const &wc)
+    {
+        bool has_imm = (wc.wc_flags & IBV_WC_WITH_IMM) != 0;
+        return {wc.wr_id,  wc.status, wc.opcode,
+                wc.byte_len, has_imm, has_imm ? ntohl(wc.imm_data) : 0};
+    }
+};
+
+/**
+ * @brief A failed completion, with the context of its work request.
+ * Only the status, wr_id, QP number and vendor error of a failed `ibv_wc` are valid. Once a WR
+ * fails, the QP enters the error state, and every WR outstanding on it completes with
+ * `IBV_WC_WR_FLUSH_ERR`; the first failed completion names the culprit.
+ */
+struct CompletionError {
+    int peer_id;            // The peer of the connection
+    int conn_id;            // ID of the connection
+    char const *conn_type;  // "rc" or "xrc"
+    bool send;              // Whether it came from the send CQ (otherwise the recv CQ)
+    uint64_t wr_id;         // wr_id of the failed WR
+    ibv_wc_status status;   // Completion status
+    uint32_t vendor_err;    // Vendor syndrome
+    uint32_t qp_num;        // Local QP number
+
+    /**
+     * @brief Record a failed completion.
+     */
+    static inline CompletionError from(ibv_wc const &wc, int peer_id, int conn_id,
+                                       char const *conn_type, bool send)
+    {
+        return {peer_id, conn_id, conn_type, send, wc.wr_id, wc.status, wc.vendor_err, wc.qp_num};
+    }
+
+    /**
+     * @brief Print a human-readable description, prefixed by the local node ID.
+     */
+    inline void print(int node_id) const
+    {
+        fprintf(stderr,
+                "[node %d] peer %d %s %d (qp 0x%x): %s wr_id %lu failed: %s (vendor 0x%x)\n",
+                node_id, this->peer_id, this->conn_type, this->conn_id, this->qp_num,
+                this->send ? "send" : "recv", this->wr_id, ibv_wc_status_str(this->status),
+                this->vendor_err);
+    }
+};
+
+/**
+ * @brief A handler of failed completions, see `ReliableConnection::set_error_handler`.
+ */
+using ErrorHandler = std::function<void(CompletionError const &)>;
+
+}  // namespace rdma
+
+#endif  // __COMPLETION_H__
@@ -1,12 +1,20 @@
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
 
+#include "allocator.h"
 #include "context.h"
+#include "reg_cache.h"
 
 namespace rdma {
 
-Context::Context(char const *dev_name) : nmrs(0), refcnt(0)
+Context::Context(char const *dev_name, int port, int gid_index)
+    : port(port), gid_index(gid_index), reg_stats{0, 0, 0}, reg_cache(nullptr), refcnt(0)
 {
     int n_devices;
     ibv_device **dev_list = ibv_get_device_list(&n_devices);
@@ -31,8 +39,11 @@ Context::Context(char const *dev_name) : nmrs(0), refcnt(0)
 
     this->ctx = ctx;
     this->check_dev_attr();
-    ibv_query_port(this->ctx, 1, &this->port_attr);
-    ibv_query_gid(this->ctx, 1, 1, &this->gid);
+    this->detect_numa_node();
+    if (ibv_query_port(this->ctx, port, &this->port_attr))
+        Emergency::abort("cannot query port " + std::to_string(port));
+    if (ibv_query_gid(this->ctx, port, gid_index, &this->gid))
+        Emergency::abort("cannot query GID index " + std::to_string(gid_index));
 
     // Protected Domain
     this->pd = ibv_alloc_pd(ctx);
@@ -43,6 +54,9 @@ Context::Context(char const *dev_name) : nmrs(0), refcnt(0)
     xrcd_init_attr.oflags = O_CREAT;
     xrcd_init_attr.comp_mask = IBV_XRCD_INIT_ATTR_FD | IBV_XRCD_INIT_ATTR_OFLAGS;
     this->xrcd = ibv_open_xrcd(ctx, &xrcd_init_attr);
+
+    // Registered memory allocator (registers lazily)
+    this->slab = new SlabAllocator(*this);
 }
 
 Context::~Context()
@@ -53,8 +67,13 @@ Context::~Context()
     }
 
     // MR -> XRCD -> PD -> Context
-    for (int i = 0; i < this->nmrs; ++i)
-        ibv_dereg_mr(this->mrs[i]);
+    for (auto mr : this->mrs)
+        if (mr)
+            ibv_dereg_mr(mr);
+    delete this->reg_cache.load();
+    delete this->slab;
+    for (auto [addr, size] : this->mappings)
+        munmap(addr, size);
     ibv_close_xrcd(this->xrcd);
     ibv_dealloc_pd(this->pd);
     ibv_close_device(this->ctx);
@@ -62,15 +81,16 @@ Context::~Context()
 
 int Context::reg_mr(void *addr, size_t size, int perm)
 {
-    if (this->nmrs >= Consts::MaxMrs)
-        return -1;
-
+    auto start = std::chrono::steady_clock::now();
     ibv_mr *mr = ibv_reg_mr(this->pd, addr, size, perm);
     if (mr == nullptr)
         return -1;
+    auto end = std::chrono::steady_clock::now();
 
-    this->mrs[this->nmrs] = mr;
-    return this->nmrs++;
+    int id = this->add_mr(mr);
+    std::lock_guard<std::mutex> lock(this->mr_mutex);
+    this->reg_stats = {1, 0, std::chrono::duration<double, std::milli>(end - start).count()};
+    return id;
 }
 
 int Context::reg_mr(uintptr_t addr, size_t size, int perm)
@@ -78,6 +98,228 @@ int Context::reg_mr(uintptr_t addr, size_t size, int perm)
     return this->reg_mr(reinterpret_cast<void *>(addr), size, perm);
 }
 
+int Context::reg_mr_parallel(void *addr, size_t size, int nthreads, size_t chunk_size, int perm)
+{
+    static const uintptr_t PageBytes = sysconf(_SC_PAGESIZE);
+
+    if (nthreads <= 0 || chunk_size == 0 || size == 0)
+        return -1;
+    char *base = reinterpret_cast<char *>(addr);
+    size_t nchunks = (size + chunk_size - 1) / chunk_size;
+
+    // Threads take chunks round-robin
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([=] {
+            for (size_t i = t; i < nchunks; i += nthreads) {
+                char *p = base + i * chunk_size;
+                char *end = base + std::min(size, (i + 1) * chunk_size);
+#if defined(MADV_POPULATE_WRITE)
+                // Populating whole pages leaves the bytes around the region untouched
+                uintptr_t first = reinterpret_cast<uintptr_t>(p) & ~(PageBytes - 1);
+                uintptr_t last = (reinterpret_cast<uintptr_t>(end) + PageBytes - 1) &
+                                 ~(PageBytes - 1);
+                if (madvise(reinterpret_cast<void *>(first), last - first,
+                            MADV_POPULATE_WRITE) == 0)
+                    continue;
+#endif
+                // Write back one byte read in every page, inside [p, end) only, so that neither
+                // the contents nor the data next to the region are changed
+                uintptr_t stop = reinterpret_cast<uintptr_t>(end);
+                for (uintptr_t q = reinterpret_cast<uintptr_t>(p); q < stop;
+                     q = (q | (PageBytes - 1)) + 1) {
+                    char volatile *c = reinterpret_cast<char volatile *>(q);
+                    *c = *c;
+                }
+            }
+        });
+    for (auto &thread : threads)
+        thread.join();
+    auto mid = std::chrono::steady_clock::now();
+
+    ibv_mr *mr = ibv_reg_mr(this->pd, addr, size, perm);
+    if (mr == nullptr)
+        return -1;
+    auto end = std::chrono::steady_clock::now();
+
+    int id = this->add_mr(mr);
+    std::lock_guard<std::mutex> lock(this->mr_mutex);
+    this->reg_stats = {nchunks, std::chrono::duration<double, std::milli>(mid - start).count(),
+                       std::chrono::duration<double, std::milli>(end - mid).count()};
+    return id;
+}
+
+int Context::reg_mr_odp(void *addr, size_t size, int perm)
+{
+    ibv_exp_reg_mr_in in;
+    memset(&in, 0, sizeof(ibv_exp_reg_mr_in));
+    in.pd = this->pd;
+    in.addr = addr;
+    in.length = size;
+    in.exp_access = perm | IBV_EXP_ACCESS_ON_DEMAND;
+
+    ibv_mr *mr = ibv_exp_reg_mr(&in);
+    if (mr == nullptr)
+        return -1;
+    return this->add_mr(mr);
+}
+
+int Context::reg_mr_implicit_odp(int perm)
+{
+    if (!(this->device_attr.odp_caps.general_odp_caps & IBV_EXP_ODP_SUPPORT_IMPLICIT))
+        return -1;
+    return this->reg_mr_odp(nullptr, IBV_EXP_IMPLICIT_MR_SIZE, perm);
+}
+
+int Context::prefetch_mr(void *addr, size_t size, bool write)
+{
+    ibv_mr *mr = this->find_mr(addr, size);
+    if (mr == nullptr)
+        return -1;
+
+    ibv_exp_prefetch_attr attr;
+    memset(&attr, 0, sizeof(ibv_exp_prefetch_attr));
+    attr.flags = write ? IBV_EXP_PREFETCH_WRITE_ACCESS : 0;
+    attr.addr = addr;
+    attr.length = size;
+    return ibv_exp_prefetch_mr(mr, &attr);
+}
+
+ibv_mw *Context::alloc_mw() { return ibv_alloc_mw(this->pd, IBV_MW_TYPE_2); }
+
+void Context::dealloc_mw(ibv_mw *mw) { ibv_dealloc_mw(mw); }
+
+int Context::alloc_mr(size_t size, PageSize want, PageSize *obtained, int perm)
+{
+    PageMapping mapping;
+    int err = map_pages(size, want, this->numa, &mapping);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    int id = this->reg_mr(mapping.addr, mapping.len, perm);
+    if (id < 0) {
+        err = errno;
+        munmap(mapping.addr, mapping.len);
+        errno = err;
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mr_mutex);
+        this->mappings.emplace_back(mapping.addr, mapping.len);
+    }
+    if (obtained)
+        *obtained = mapping.page;
+    return id;
+}
+
+void *Context::alloc(size_t size) { return this->slab->alloc(size); }
+
+void Context::dealloc(void *ptr) { this->slab->free(ptr); }
+
+int Context::reserve(size_t size, size_t count) { return this->slab->reserve(size, count); }
+
+int Context::enable_reg_cache(size_t budget)
+{
+    if (!RegistrationCache::supported(*this))
+        return -1;
+
+    auto cache = new RegistrationCache(*this, budget);
+    RegistrationCache *expected = nullptr;
+    if (!this->reg_cache.compare_exchange_strong(expected, cache))
+        delete cache;
+    return 0;
+}
+
+void Context::invalidate_reg_cache(void const *addr, size_t size)
+{
+    RegistrationCache *cache = this->reg_cache.load();
+    if (cache)
+        cache->invalidate(addr, size);
+}
+
+void Context::release_reg_cache()
+{
+    RegistrationCache *cache = this->reg_cache.load();
+    if (cache)
+        cache->release();
+}
+
+uint32_t Context::match_reg_cache_lkey(void const *addr, size_t size) const
+{
+    uint32_t lkey;
+    RegistrationCache *cache = this->reg_cache.load();
+    if (cache && cache->lookup(addr, size, &lkey))
+        return lkey;
+    Emergency::abort("cannot match local mr");
+}
+
+ibv_mr *Context::find_mr(void const *addr, size_t size) const
+{
+    std::lock_guard<std::mutex> lock(this->mr_mutex);
+
+    ibv_mr *mr = nullptr;
+    for (auto m : this->mrs) {
+        if (m == nullptr)
+            continue;
+        if (addr < m->addr || reinterpret_cast<char const *>(addr) + size >
+                                  reinterpret_cast<char const *>(m->addr) + m->length)
+            continue;
+        mr = m;
+        if (m->addr != nullptr || m->length != IBV_EXP_IMPLICIT_MR_SIZE)
+            break;
+    }
+    return mr;
+}
+
+int Context::add_mrs(ibv_mr *const *mrs, size_t count)
+{
+    std::lock_guard<std::mutex> lock(this->mr_mutex);
+
+    for (size_t i = 0; i < count; ++i)
+        this->mr_index.insert(reinterpret_cast<uintptr_t>(mrs[i]->addr), mrs[i]->length,
+                              mrs[i]->lkey);
+
+    this->mrs.insert(this->mrs.end(), mrs, mrs + count);
+    return this->mrs.size() - count;
+}
+
+ibv_mr *Context::reg_private_mr(void *addr, size_t size, int perm)
+{
+    ibv_mr *mr = ibv_reg_mr(this->pd, addr, size, perm);
+    if (mr != nullptr)
+        this->mr_index.insert(reinterpret_cast<uintptr_t>(addr), size, mr->lkey);
+    return mr;
+}
+
+void Context::dereg_private_mr(ibv_mr *mr)
+{
+    this->mr_index.erase(reinterpret_cast<uintptr_t>(mr->addr), mr->length, mr->lkey);
+    ibv_dereg_mr(mr);
+}
+
+void Context::drop_mr(int id)
+{
+    std::lock_guard<std::mutex> lock(this->mr_mutex);
+
+    ibv_mr *mr = this->mrs[id];
+    if (mr == nullptr)
+        return;
+    this->mr_index.erase(reinterpret_cast<uintptr_t>(mr->addr), mr->length, mr->lkey);
+
+    ibv_dereg_mr(mr);
+    this->mrs[id] = nullptr;
+}
+
+void Context::detect_numa_node()
+{
+    this->numa = numa_node_of("/sys/class/infiniband/" +
+                              std::string(ibv_get_device_name(this->ctx->device)) + "/device");
+}
+
 void Context::check_dev_attr()
 {
     ibv_exp_device_attr dev_attr;
@@ -93,6 +335,13 @@ void Context::check_dev_attr()
     // Multi-packet
     dev_attr.comp_mask |= IBV_EXP_DEVICE_ATTR_MP_RQ;
 
+    // ODP
+    dev_attr.comp_mask |= IBV_EXP_DEVICE_ATTR_ODP;
+
+    // Completion timestamps
+    dev_attr.comp_mask |= IBV_EXP_DEVICE_ATTR_WITH_HCA_CORE_CLOCK;
+    dev_attr.comp_mask |= IBV_EXP_DEVICE_ATTR_WITH_TIMESTAMP_MASK;
+
     // EC
     dev_attr.exp_device_cap_flags |= IBV_EXP_DEVICE_EC_OFFLOAD;
     dev_attr.comp_mask |= IBV_EXP_DEVICE_ATTR_EC_CAPS;
@@ -100,6 +349,7 @@ void Context::check_dev_attr()
 
     ibv_exp_query_device(this->ctx, &dev_attr);
     this->device_attr = dev_attr;
+    this->clock.init(this->ctx, dev_attr);
 
     auto check_bit = [](uint64_t x, uint64_t mask) -> bool { return !!(x & mask); };
 
@@ -109,8 +359,14 @@ void Context::check_dev_attr()
     if (!check_bit(dev_attr.comp_mask, IBV_EXP_DEVICE_ATTR_MP_RQ))
         fprintf(stderr, "ibv_exp: NIC does not support multi-packet srq\n");
 
+    if (!check_bit(dev_attr.exp_device_cap_flags, IBV_EXP_DEVICE_ODP))
+        fprintf(stderr, "ibv_exp: NIC does not support ODP\n");
+
     if (!check_bit(dev_attr.exp_device_cap_flags, IBV_EXP_DEVICE_EC_OFFLOAD))
         fprintf(stderr, "ibv_exp: NIC does not support EC offload\n");
+
+    if (!this->clock.supported())
+        fprintf(stderr, "ibv_exp: NIC does not support completion timestamps\n");
 }
 
 }  // namespace rdma
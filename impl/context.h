@@ -1,10 +1,29 @@
 #if !defined(__CONTEXT_H__)
 #define __CONTEXT_H__
 
+#include <memory>
+#include <mutex>
+
+#include "hw_clock.h"
+#include "mr_index.h"
+#include "pages.h"
 #include "rdma_base.h"
+#include "span.h"
 
 namespace rdma {
 
+class RegistrationCache;
+class SlabAllocator;
+
+/**
+ * @brief Timing of a memory registration, for comparing registration modes.
+ */
+struct RegStats {
+    size_t chunks;          // Number of chunks pre-faulted in parallel (1 for `reg_mr`)
+    double prefault_ms;     // Time spent pre-faulting pages, wall-clock (0 for `reg_mr`)
+    double register_ms;     // Time spent in `ibv_reg_mr`, wall-clock
+};
+
 /**
  * @brief Represent an RDMA context (`ibv_context *`).
  * Context does not maintain RDMA protection domains; they are maintained by
@@ -17,6 +36,9 @@ class Context {
 
     friend class ReliableConnection;
     friend class ExtendedReliableConnection;
+    friend class RegistrationCache;
+    friend class SlabAllocator;
+    friend class MultiRail;
 
   public:
     /**
@@ -24,8 +46,10 @@ class Context {
      * Throws std::runtime_error if cannot find the specified device.
      *
      * @param dev_name Name of the wanted RDMA NIC device.
+     * @param port Physical port number of the device to use.
+     * @param gid_index Index of the local GID (of the port) to use.
      */
-    explicit Context(char const *dev_name = nullptr);
+    explicit Context(char const *dev_name = nullptr, int port = 1, int gid_index = 1);
 
     /**
      * @brief Copying the RDMA context is prohibited.
@@ -60,11 +84,204 @@ class Context {
      */
     int reg_mr(uintptr_t addr, size_t size, int perm = 0xF);
 
+    /**
+     * @brief Register a very large memory region, faulting its pages in on several threads first.
+     * Most of the time `ibv_reg_mr` spends on a fresh region goes to faulting in (and zeroing)
+     * pages one by one. Here threads fault in chunks of the region concurrently, then a single
+     * `ibv_reg_mr` call pins the resident pages, so the region is one MR with one key: any range
+     * inside it matches, both locally and at peers. What stays serial is pinning the pages and
+     * writing their translations, which grows with the number of pages (fewer with huge pages).
+     * Contents of the region are kept.
+     *
+     * @param addr Start address of the memory region.
+     * @param size Length in bytes of the memory region.
+     * @param nthreads Number of pre-faulting threads.
+     * @param chunk_size Length in bytes of each chunk handed to a thread.
+     * @param perm Access permission (defaulted to all necessary).
+     * @return int ID of the memory region, -1 on any error.
+     */
+    int reg_mr_parallel(void *addr, size_t size, int nthreads = 8, size_t chunk_size = 1ul << 30,
+                        int perm = 0xF);
+
+    /**
+     * @brief Get the timing of the last successful `reg_mr` or `reg_mr_parallel` call.
+     * @return RegStats Timing of the registration.
+     */
+    inline RegStats last_reg_stats() const
+    {
+        std::lock_guard<std::mutex> lock(this->mr_mutex);
+        return this->reg_stats;
+    }
+
+    /**
+     * @brief Register an on-demand paging (ODP) memory region.
+     * Pages are not pinned; the RNIC faults them in on first access, which costs latency. Use
+     * `prefetch_mr` to pre-fault a range before a burst of traffic.
+     *
+     * @param addr Start address of the memory region.
+     * @param size Length in bytes of the memory region.
+     * @param perm Access permission (defaulted to all necessary).
+     * @return int ID of the memory region, -1 on any error.
+     */
+    int reg_mr_odp(void *addr, size_t size, int perm = 0xF);
+
+    /**
+     * @brief Register an implicit ODP memory region covering the whole address space.
+     * Any local or remote address that misses all other memory regions is matched to it, so
+     * peers can access any address of this process. At most one is allowed per Context.
+     *
+     * @param perm Access permission (defaulted to all necessary).
+     * @return int ID of the memory region, -1 on any error (including no device support).
+     */
+    int reg_mr_implicit_odp(int perm = 0xF);
+
+    /**
+     * @brief Pre-fault a range of an ODP memory region (explicit or implicit) into the RNIC.
+     *
+     * @param addr Start address of the range.
+     * @param size Length in bytes of the range.
+     * @param write If true, fault in for write access.
+     * @return int The status code returned by `ibv_exp_prefetch_mr`, -1 if no MR covers the range.
+     */
+    int prefetch_mr(void *addr, size_t size, bool write = true);
+
+    /**
+     * @brief Allocate a type 2 memory window.
+     * Bind it to a range of a memory region (registered with `IBV_ACCESS_MW_BIND` in `perm`) with
+     * `ReliableConnection::post_bind_mw`, and revoke with
+     * `ReliableConnection::post_invalidate_mw`.
+     *
+     * @return ibv_mw* The memory window, nullptr on any error.
+     */
+    ibv_mw *alloc_mw();
+
+    /**
+     * @brief Deallocate a memory window obtained from `alloc_mw`.
+     *
+     * @param mw The memory window.
+     */
+    void dealloc_mw(ibv_mw *mw);
+
+    /**
+     * @brief Allocate memory with huge pages on the RNIC's NUMA node and register it.
+     * Tries `want` first and falls back to smaller hugetlb pages, then to transparent huge
+     * pages, then to normal pages (see `map_pages`). Memory is bound to the NUMA node the RNIC is
+     * attached to (if known) before it is faulted in, and is unmapped when the Context is
+     * destructed. Use `local_span(id)` to get the address of the memory region.
+     *
+     * @param size Length in bytes, rounded up to the page size obtained (2 MB for THP).
+     * @param want Preferred page size (defaulted to 2 MB).
+     * @param obtained Output, the page size actually backing the memory (optional).
+     * @param perm Access permission (defaulted to all necessary).
+     * @return int ID of the memory region, -1 on any error, with `errno` set (e.g., by `mbind`
+     * if the memory cannot be bound to the RNIC's NUMA node).
+     */
+    int alloc_mr(size_t size, PageSize want = PageSize::Huge2M, PageSize *obtained = nullptr,
+                 int perm = 0xF);
+
+    /**
+     * @brief Enable the registration cache for local buffers outside the registered MRs.
+     * Afterwards, posting from or to such a buffer registers it on first use instead of dying.
+     * The cache is local-only; peers cannot access buffers registered by it. It registers ODP
+     * MRs, so cached buffers may be freed or unmapped at any time (see `RegistrationCache`).
+     *
+     * @param budget Maximum bytes registered by the cache (defaulted to 1 GB).
+     * @return int 0 on success, -1 if the RNIC does not support ODP for RC.
+     */
+    int enable_reg_cache(size_t budget = 1ul << 30);
+
+    /**
+     * @brief Evict cached registrations of a range, e.g., to reclaim budget from buffers that
+     * will not be used again. Not needed for unmapped memory.
+     *
+     * @param addr Start address of the range.
+     * @param size Length in bytes of the range.
+     */
+    void invalidate_reg_cache(void const *addr, size_t size);
+
+    /**
+     * @brief Deregister registrations evicted from the cache. Call it only when every WR posted
+     * through the cache so far has completed (e.g., after draining all connections).
+     */
+    void release_reg_cache();
+
+    /**
+     * @brief Get the NUMA node the RNIC is attached to.
+     * @return int The NUMA node, -1 if unknown.
+     */
+    inline int numa_node() const { return this->numa; }
+
+    /**
+     * @brief Get the RNIC clock, to convert completion timestamps to host time.
+     * @return HwClock& The clock; `supported()` is false if the RNIC does not stamp completions.
+     */
+    inline HwClock &hw_clock() { return this->clock; }
+    inline HwClock const &hw_clock() const { return this->clock; }
+
     /**
      * @brief Get the count of currently registered memory regions.
      * @return size_t Count of registered memory regions.
      */
-    inline size_t mr_count() const { return nmrs; }
+    inline size_t mr_count() const
+    {
+        std::lock_guard<std::mutex> lock(this->mr_mutex);
+        return mrs.size();
+    }
+
+    /**
+     * @brief Resolve the lkey of a registered local buffer once, for repeated posts.
+     * Dies if the buffer is not covered by a registered memory region.
+     *
+     * @param addr Start address of the buffer.
+     * @param size Length in bytes of the buffer.
+     * @return LocalSpan The buffer with its lkey.
+     */
+    inline LocalSpan local_span(void *addr, size_t size) const
+    {
+        return {addr, size, this->match_mr_lkey(addr, size)};
+    }
+
+    /**
+     * @brief Get a whole registered memory region as a local span.
+     *
+     * @param id ID of the memory region (default to 0).
+     * @return LocalSpan The memory region with its lkey.
+     */
+    inline LocalSpan local_span(int id = 0) const
+    {
+        std::lock_guard<std::mutex> lock(this->mr_mutex);
+        if (this->mrs[id] == nullptr)
+            Emergency::abort("memory region " + std::to_string(id) + " has been dropped");
+        return {this->mrs[id]->addr, this->mrs[id]->length, this->mrs[id]->lkey};
+    }
+
+    /**
+     * @brief Allocate a cache-line-aligned buffer from locally registered memory.
+     * Served from the per-thread free-lists of the Context-owned slab allocator; it only registers
+     * new memory when the free-lists of the size class run dry (see `reserve`). Buffers can be
+     * the local side of any post, but peers cannot access them.
+     *
+     * @param size Bytes to allocate, at most `SlabAllocator::MaxBlockSize`.
+     * @return void* The allocated buffer, nullptr on any error.
+     */
+    void *alloc(size_t size);
+
+    /**
+     * @brief Return a buffer obtained from `alloc` to the slab allocator.
+     *
+     * @param ptr The buffer to free.
+     */
+    void dealloc(void *ptr);
+
+    /**
+     * @brief Register memory upfront so that the next `count` allocations of `size` bytes never
+     * trigger registration.
+     *
+     * @param size Bytes of each allocation.
+     * @param count Number of allocations.
+     * @return int 0 on success, -1 on any error.
+     */
+    int reserve(size_t size, size_t count);
 
     /**
      * @brief Get the original RDMA context object.
@@ -84,41 +301,61 @@ class Context {
      */
     void check_dev_attr();
 
+    /**
+     * @brief Read the NUMA node of the RNIC from sysfs.
+     */
+    void detect_numa_node();
+
+    /**
+     * @brief Find the registered MR covering a range, preferring explicit MRs over an implicit
+     * ODP MR. This is a linear scan; do not use it on the per-post path.
+     *
+     * @return ibv_mr* The MR, nullptr if no MR covers the range.
+     */
+    ibv_mr *find_mr(void const *addr, size_t size) const;
+
+    /**
+     * @brief Record registered MRs and queue them for the lkey index, which publishes them all in
+     * one new version at the next lookup that misses (see `MrIndexVersions`).
+     *
+     * @return int ID of the first memory region, the others follow in order.
+     */
+    int add_mrs(ibv_mr *const *mrs, size_t count);
+    inline int add_mr(ibv_mr *mr) { return this->add_mrs(&mr, 1); }
+
+    /**
+     * @brief Register memory for the library's own use (e.g., slab chunks). It is indexed for
+     * lkey lookups, but takes no ID: peers never see it, IDs of user MRs are not shifted, and
+     * `last_reg_stats` is left alone.
+     *
+     * @return ibv_mr* The MR, nullptr on any error. Deregister it with `dereg_private_mr`.
+     */
+    ibv_mr *reg_private_mr(void *addr, size_t size, int perm = IBV_ACCESS_LOCAL_WRITE);
+    void dereg_private_mr(ibv_mr *mr);
+
+    /**
+     * @brief Deregister an MR to undo its registration, e.g., when registering on another rail
+     * failed. Its ID stays taken, so the IDs of later MRs keep matching on the remote side;
+     * peers see it as an empty region.
+     */
+    void drop_mr(int id);
+
     /**
      * @brief Match a given address range to MR and return its lkey.
      */
     inline uint32_t match_mr_lkey(void const *addr, size_t size = 0) const
     {
-        switch (this->nmrs) {
-        case 4:
-            if (addr >= this->mrs[3]->addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->mrs[3]->addr) + this->mrs[3]->length)
-                return this->mrs[3]->lkey;
-            [[fallthrough]];
-        case 3:
-            if (addr >= this->mrs[2]->addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->mrs[2]->addr) + this->mrs[2]->length)
-                return this->mrs[2]->lkey;
-            [[fallthrough]];
-        case 2:
-            if (addr >= this->mrs[1]->addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->mrs[1]->addr) + this->mrs[1]->length)
-                return this->mrs[1]->lkey;
-            [[fallthrough]];
-        case 1:
-            if (addr >= this->mrs[0]->addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->mrs[0]->addr) + this->mrs[0]->length)
-                return this->mrs[0]->lkey;
-            [[fallthrough]];
-        default:
-            Emergency::abort("cannot match local mr");
-        }
+        uint32_t lkey;
+        if (__glibc_likely(this->mr_index.lookup(reinterpret_cast<uintptr_t>(addr), size, &lkey)))
+            return lkey;
+        return this->match_reg_cache_lkey(addr, size);
     }
 
+    /**
+     * @brief Slow path of `match_mr_lkey`: match the range in the registration cache, if enabled.
+     */
+    uint32_t match_reg_cache_lkey(void const *addr, size_t size) const;
+
     /**
      * @brief Match a given address range to MR and return its lkey.
      */
@@ -131,11 +368,21 @@ class Context {
     ibv_port_attr port_attr;
     ibv_context *ctx;
     ibv_gid gid;
+    int port;
+    int gid_index;
     ibv_pd *pd;
     ibv_xrcd *xrcd;
+    int numa;
+    HwClock clock;
+
+    mutable std::mutex mr_mutex;
+    std::vector<ibv_mr *> mrs;
+    MrIndexVersions mr_index;
+    std::vector<std::pair<void *, size_t>> mappings;
+    RegStats reg_stats;
 
-    int nmrs = 0;
-    std::array<ibv_mr *, Consts::MaxMrs> mrs;
+    SlabAllocator *slab;
+    std::atomic<RegistrationCache *> reg_cache;
     std::atomic<unsigned> refcnt;
 };
 
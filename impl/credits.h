@@ -0,0 +1,151 @@
+#if !defined(__CREDITS_H__)
+#define __CREDITS_H__
+
+#include <deque>
+
+#include "rdma_base.h"
+
+namespace rdma {
+
+/**
+ * @brief Send queue credit tracking and selective signaling, owned by a connection.
+ * Every posted WR takes a credit, and at least every `signal_every`-th WR is signaled (with
+ * `AutoWrId` as wr_id if the caller did not signal it). Send queue completions arrive in posting
+ * order, so each completion returns the credits of all WRs since the previous signaled one.
+ * Completions of automatically signaled WRs are consumed here; those the caller asked for are
+ * handed out by `poll`, including any picked up while waiting for credits.
+ */
+class SendCredits {
+  public:
+    /**
+     * @brief wr_id of automatically signaled WRs, reserved in managed mode.
+     */
+    static const uint64_t AutoWrId = UINT64_MAX;
+
+    SendCredits() : depth(0), signal_every(0), outstanding(0), since_signal(0), block(true) {}
+
+    inline void enable(int depth, int signal_every, bool blocking)
+    {
+        if (signal_every <= 0 || signal_every > depth / 2)
+            signal_every = depth / 2;
+        this->depth = depth;
+        this->signal_every = signal_every;
+        this->block = blocking;
+        this->reset();
+    }
+
+    inline void disable() { this->depth = 0; }
+
+    inline bool enabled() const { return this->depth > 0; }
+
+    inline bool blocking() const { return this->block; }
+
+    /**
+     * @brief Get the largest number of WRs admitted at a time.
+     */
+    inline int max_admit() const { return this->depth - this->signal_every; }
+
+    /**
+     * @brief Check whether `n` more WRs fit into the send queue.
+     */
+    inline bool available(int n) const { return this->outstanding + n <= this->depth; }
+
+    /**
+     * @brief Take credits for a list of WRs and signal those that are due.
+     */
+    inline void track(ibv_exp_send_wr *wr)
+    {
+        for (; wr; wr = wr->next) {
+            this->outstanding++;
+            this->since_signal++;
+            if (!(wr->exp_send_flags & IBV_EXP_SEND_SIGNALED)) {
+                if (this->since_signal < this->signal_every)
+                    continue;
+                wr->exp_send_flags |= IBV_EXP_SEND_SIGNALED;
+                wr->wr_id = AutoWrId;
+            }
+            this->covered.push_back(this->since_signal);
+            this->since_signal = 0;
+        }
+    }
+
+    /**
+     * @brief Poll the send CQ once to return credits, keeping completions the caller asked for.
+     * @return int Number of credits returned.
+     */
+    inline int reclaim(ibv_cq *cq)
+    {
+        ibv_wc wc_arr[16];
+        int before = this->outstanding;
+        int n = ibv_poll_cq(cq, 16, wc_arr);
+        if (n > 0) {
+            n = this->filter(wc_arr, n);
+            this->stash.insert(this->stash.end(), wc_arr, wc_arr + n);
+        }
+        return before - this->outstanding;
+    }
+
+    /**
+     * @brief Poll the send CQ once, returning only completions the caller asked for.
+     * @return int Number of completions returned.
+     */
+    inline int poll(ibv_cq *cq, ibv_wc *wc_arr, int n)
+    {
+        int k = 0;
+        while (k < n && !this->stash.empty()) {
+            wc_arr[k++] = this->stash.front();
+            this->stash.pop_front();
+        }
+        if (k < n) {
+            int res = ibv_poll_cq(cq, n - k, wc_arr + k);
+            if (res > 0)
+                k += this->filter(wc_arr + k, res);
+        }
+        return k;
+    }
+
+    /**
+     * @brief Forget every WR in flight, e.g., after the QP has been reset.
+     */
+    inline void reset()
+    {
+        this->outstanding = 0;
+        this->since_signal = 0;
+        this->covered.clear();
+    }
+
+  private:
+    // Return credits of completions and drop automatic ones, compacting in place
+    inline int filter(ibv_wc *wc_arr, int n)
+    {
+        int kept = 0;
+        for (int i = 0; i < n; ++i) {
+            if (__glibc_unlikely(wc_arr[i].status != IBV_WC_SUCCESS)) {
+                // The QP is in error: everything outstanding is flushed
+                this->reset();
+                wc_arr[kept++] = wc_arr[i];
+                continue;
+            }
+            if (__glibc_likely(!this->covered.empty())) {
+                this->outstanding -= this->covered.front();
+                this->covered.pop_front();
+            }
+            if (wc_arr[i].wr_id != AutoWrId)
+                wc_arr[kept++] = wc_arr[i];
+        }
+        return kept;
+    }
+
+    int depth;
+    int signal_every;
+    int outstanding;   // WRs posted and not known to be completed
+    int since_signal;  // WRs posted since the last signaled one
+    bool block;
+
+    std::deque<int> covered;  // For each signaled WR in flight, the number of WRs it completes
+    std::deque<ibv_wc> stash;
+};
+
+}  // namespace rdma
+
+#endif  // __CREDITS_H__
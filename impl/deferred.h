@@ -0,0 +1,135 @@
+#if !defined(__DEFERRED_H__)
+#define __DEFERRED_H__
+
+#include <cstring>
+
+#include "rdma_base.h"
+
+namespace rdma {
+
+/**
+ * @brief Chain of work requests whose doorbell is deferred, owned by a connection.
+ * Posts append copies of their WRs (with SGEs) here instead of calling `ibv_exp_post_send`, and
+ * the connection posts the whole chain with one call (hence one doorbell) when it is flushed.
+ * Inline payloads are copied into the chain, so their buffers can be reused right away.
+ */
+class DeferredChain {
+  public:
+    DeferredChain() : threshold(0), count(0) {}
+
+    /**
+     * @brief Start deferring. The chain holds at most `threshold` WRs.
+     */
+    inline void enable(int threshold)
+    {
+        if (threshold <= 0 || threshold > Consts::MaxQueueDepth)
+            threshold = Consts::MaxQueueDepth;
+        this->threshold = threshold;
+        this->wrs.resize(threshold);
+        this->sges.resize(threshold * Consts::MaxSge);
+        this->inline_data.resize(threshold * Consts::MaxInlineData);
+    }
+
+    /**
+     * @brief Stop deferring. The chain must have been flushed.
+     */
+    inline void disable() { this->threshold = 0; }
+
+    inline bool enabled() const { return this->threshold > 0; }
+
+    inline int size() const { return this->count; }
+
+    /**
+     * @brief Check whether the chain is full, i.e., a flush failed and left it so.
+     */
+    inline bool full() const { return this->threshold > 0 && this->count >= this->threshold; }
+
+    /**
+     * @brief Append a copy of a WR to the chain.
+     * @return true If the chain is full and must be flushed now.
+     */
+    inline bool append(ibv_exp_send_wr const *wr)
+    {
+        ibv_exp_send_wr &slot = this->wrs[this->count];
+        slot = *wr;
+        slot.next = nullptr;
+        if (wr->num_sge > 0) {
+            slot.sg_list = &this->sges[this->count * Consts::MaxSge];
+            memcpy(slot.sg_list, wr->sg_list, wr->num_sge * sizeof(ibv_sge));
+        }
+        if (slot.exp_send_flags & IBV_EXP_SEND_INLINE)
+            this->copy_inline(slot);
+        if (this->count > 0)
+            this->wrs[this->count - 1].next = &slot;
+        return ++this->count >= this->threshold;
+    }
+
+    /**
+     * @brief Get the first WR of the chain.
+     */
+    inline ibv_exp_send_wr *head() { return this->wrs.data(); }
+
+    inline void clear() { this->count = 0; }
+
+    /**
+     * @brief Drop the WRs posted ahead of a failed one, keeping it and the rest in order.
+     *
+     * @param bad_wr The WR reported by `ibv_exp_post_send` as the first one not posted.
+     */
+    inline void retain_from(ibv_exp_send_wr const *bad_wr)
+    {
+        int first = bad_wr - this->wrs.data();
+        if (first <= 0 || first >= this->count)
+            return;
+        for (int i = first; i < this->count; ++i)
+            this->move(i, i - first);
+        this->count -= first;
+        for (int i = 0; i < this->count; ++i)
+            this->wrs[i].next = i + 1 < this->count ? &this->wrs[i + 1] : nullptr;
+    }
+
+  private:
+    // Gather the inline payload into the slot's buffer, the SGE buffers may be reused
+    inline void copy_inline(ibv_exp_send_wr &slot)
+    {
+        char *buf = &this->inline_data[this->count * Consts::MaxInlineData];
+        size_t len = 0;
+        for (int i = 0; i < slot.num_sge; ++i) {
+            if (len + slot.sg_list[i].length > Consts::MaxInlineData)
+                return;
+            memcpy(buf + len, reinterpret_cast<void *>(slot.sg_list[i].addr),
+                   slot.sg_list[i].length);
+            len += slot.sg_list[i].length;
+        }
+        slot.sg_list[0] = {reinterpret_cast<uintptr_t>(buf), static_cast<uint32_t>(len), 0};
+        slot.num_sge = 1;
+    }
+
+    // Move a WR to an earlier slot, along with its SGEs and inline payload
+    inline void move(int from, int to)
+    {
+        ibv_exp_send_wr &slot = this->wrs[to];
+        slot = this->wrs[from];
+        if (slot.num_sge == 0)
+            return;
+        slot.sg_list = &this->sges[to * Consts::MaxSge];
+        memcpy(slot.sg_list, &this->sges[from * Consts::MaxSge], slot.num_sge * sizeof(ibv_sge));
+
+        char *from_buf = &this->inline_data[from * Consts::MaxInlineData];
+        if (slot.sg_list[0].addr == reinterpret_cast<uintptr_t>(from_buf)) {
+            char *to_buf = &this->inline_data[to * Consts::MaxInlineData];
+            memcpy(to_buf, from_buf, slot.sg_list[0].length);
+            slot.sg_list[0].addr = reinterpret_cast<uintptr_t>(to_buf);
+        }
+    }
+
+    int threshold;
+    int count;
+    std::vector<ibv_exp_send_wr> wrs;
+    std::vector<ibv_sge> sges;
+    std::vector<char> inline_data;
+};
+
+}  // namespace rdma
+
+#endif  // __DEFERRED_H__
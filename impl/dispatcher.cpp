@@ -0,0 +1,146 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include "dispatcher.h"
+#include "rc/rc.h"
+#include "xrc/xrc.h"
+
+namespace rdma {
+
+CompletionDispatcher::CompletionDispatcher(int capacity) : flush_error(0)
+{
+    this->slots.resize(capacity);
+    for (int i = capacity - 1; i >= 0; --i) {
+        this->slots[i].generation = 0;
+        this->free_slots.push_back(i);
+    }
+}
+
+void CompletionDispatcher::add_cq(ibv_cq *cq) { this->cqs.push_back(cq); }
+
+void CompletionDispatcher::add_connection(ReliableConnection &rc)
+{
+    this->add_cq(rc.get_send_cq());
+    if (rc.get_recv_cq() != rc.get_send_cq())
+        this->add_cq(rc.get_recv_cq());
+    this->rcs.push_back(&rc);
+}
+
+void CompletionDispatcher::add_connection(ExtendedReliableConnection &xrc)
+{
+    this->add_cq(xrc.get_send_cq());
+    if (xrc.get_recv_cq() != xrc.get_send_cq())
+        this->add_cq(xrc.get_recv_cq());
+    this->xrcs.push_back(&xrc);
+}
+
+uint64_t CompletionDispatcher::expect(Continuation fn)
+{
+    return this->acquire(std::move(fn), nullptr, nullptr);
+}
+
+uint64_t CompletionDispatcher::expect(bool *done, ibv_wc_status *status)
+{
+    *done = false;
+    return this->acquire(nullptr, done, status);
+}
+
+void CompletionDispatcher::cancel(uint64_t wr_id)
+{
+    if (!this->completed(wr_id))
+        this->release(wr_id & 0xffffffff);
+}
+
+int CompletionDispatcher::poll()
+{
+    // Poll even if the flush failed: the completions free the send queue for the retry
+    this->flush_error = this->flush();
+
+    ibv_wc wc_arr[16];
+    int total = 0;
+    for (ibv_cq *cq : this->cqs) {
+        int n = ibv_poll_cq(cq, 16, wc_arr);
+        for (int i = 0; i < n; ++i)
+            this->dispatch(wc_arr[i]);
+        if (n > 0)
+            total += n;
+    }
+    return total;
+}
+
+int CompletionDispatcher::wait(uint64_t wr_id)
+{
+    while (!this->completed(wr_id)) {
+        this->poll();
+        if (__glibc_unlikely(this->flush_error != 0 && this->flush_error != ENOMEM))
+            return this->flush_error;
+    }
+    return 0;
+}
+
+uint64_t CompletionDispatcher::acquire(Continuation &&fn, bool *done, ibv_wc_status *status)
+{
+    if (__glibc_unlikely(this->free_slots.empty()))
+        return NoSlot;
+
+    uint32_t index = this->free_slots.back();
+    this->free_slots.pop_back();
+
+    Slot &slot = this->slots[index];
+    slot.generation++;
+    slot.fn = std::move(fn);
+    slot.done = done;
+    slot.status = status;
+    return (static_cast<uint64_t>(slot.generation) << 32) | index;
+}
+
+void CompletionDispatcher::release(uint32_t index)
+{
+    Slot &slot = this->slots[index];
+    slot.generation++;
+    slot.fn = nullptr;
+    this->free_slots.push_back(index);
+}
+
+int CompletionDispatcher::flush()
+{
+    // A WR still pending in deferred mode would never complete. Failed ones stay pending.
+    int error = 0;
+    for (ReliableConnection *rc : this->rcs)
+        if (__glibc_unlikely(rc->pending() > 0)) {
+            int res = rc->flush();
+            error = error ? error : res;
+        }
+    for (ExtendedReliableConnection *xrc : this->xrcs)
+        if (__glibc_unlikely(xrc->pending() > 0)) {
+            int res = xrc->flush();
+            error = error ? error : res;
+        }
+    return error;
+}
+
+void CompletionDispatcher::dispatch(ibv_wc const &wc)
+{
+    if (__glibc_unlikely(this->completed(wc.wr_id) || (wc.wr_id >> 32) % 2 == 0)) {
+        if (this->fallback)
+            this->fallback(wc);
+        return;
+    }
+
+    // Release first, so that the continuation can take the slot again
+    uint32_t index = wc.wr_id & 0xffffffff;
+    Slot &slot = this->slots[index];
+    Continuation fn = std::move(slot.fn);
+    if (slot.done) {
+        *slot.done = true;
+        if (slot.status)
+            *slot.status = wc.status;
+    }
+    this->release(index);
+
+    if (fn)
+        fn(wc);
+}
+
+}  // namespace rdma
@@ -0,0 +1,152 @@
+#if !defined(__DISPATCHER_H__)
+#define __DISPATCHER_H__
+
+#include <functional>
+
+#include "rdma_base.h"
+
+namespace rdma {
+
+/**
+ * @brief Dispatcher of completions to the logical operations that issued them.
+ * The dispatcher polls a set of CQs (e.g., the send and recv CQs of several connections) and
+ * hands out wr_ids from a table of slots. Each slot records what to do when the work request
+ * completes: run a continuation, or set a completion flag. Many independent operations can thus
+ * share a QP, and each learns about its own completion without counting completions globally.
+ *
+ * A wr_id carries the slot index in its low 32 bits and the slot generation in its high 32 bits.
+ * The generation is bumped whenever a slot is taken or released, so a stale wr_id (e.g., of a
+ * cancelled operation) never fires the continuation of a later one. Completions with wr_ids not
+ * handed out by the dispatcher are passed to the fallback handler, if any, and dropped otherwise.
+ *
+ * Only signaled work requests complete: unsignaled ones must not take a slot. The dispatcher
+ * must be the only poller of its CQs, so do not attach the send CQ of a connection in managed
+ * mode. Connections attached with `add_connection` have their pending WRs of deferred mode
+ * flushed before every poll; CQs attached with `add_cq` do not, so flush their connections
+ * before waiting. A failed flush leaves the WRs pending for the next poll to retry, and polling
+ * goes ahead so that a full send queue drains (see `flush_status`). It is not thread-safe.
+ */
+class CompletionDispatcher {
+  public:
+    /**
+     * @brief A continuation, invoked with the completion of its work request.
+     */
+    using Continuation = std::function<void(ibv_wc const &)>;
+
+    /**
+     * @brief wr_id returned when no slot is free.
+     */
+    static const uint64_t NoSlot = UINT64_MAX;
+
+    /**
+     * @brief Construct a dispatcher.
+     *
+     * @param capacity Maximum number of operations in flight.
+     */
+    explicit CompletionDispatcher(int capacity = Consts::MaxQueueDepth);
+
+    CompletionDispatcher(CompletionDispatcher const &) = delete;
+    CompletionDispatcher(CompletionDispatcher &&) = delete;
+
+    /**
+     * @brief Add a CQ to poll. The CQ is still destroyed by its owner.
+     */
+    void add_cq(ibv_cq *cq);
+
+    /**
+     * @brief Add the send and recv CQs of a connection to poll, and flush its pending WRs of
+     * deferred mode before each poll. Add each CQ only once, even if connections share it.
+     */
+    void add_connection(ReliableConnection &rc);
+    void add_connection(ExtendedReliableConnection &xrc);
+
+    /**
+     * @brief Set the handler of completions with unknown wr_ids.
+     */
+    inline void set_fallback(Continuation fallback) { this->fallback = std::move(fallback); }
+
+    /**
+     * @brief Allocate a wr_id whose completion runs a continuation.
+     * The slot is released before the continuation runs, so it may issue further operations.
+     *
+     * @param fn The continuation.
+     * @return uint64_t The wr_id to post with, or `NoSlot` if all slots are in use.
+     */
+    uint64_t expect(Continuation fn);
+
+    /**
+     * @brief Allocate a wr_id whose completion sets a flag.
+     *
+     * @param done Set to false now, and to true when the work request completes.
+     * @param status If not null, receives the completion status.
+     * @return uint64_t The wr_id to post with, or `NoSlot` if all slots are in use.
+     */
+    uint64_t expect(bool *done, ibv_wc_status *status = nullptr);
+
+    /**
+     * @brief Release the slot of a wr_id that will never complete (e.g., its post failed).
+     */
+    void cancel(uint64_t wr_id);
+
+    /**
+     * @brief Check whether the operation of a wr_id has completed (or been cancelled).
+     */
+    inline bool completed(uint64_t wr_id) const
+    {
+        uint32_t index = wr_id & 0xffffffff;
+        return index >= this->slots.size() || this->slots[index].generation != (wr_id >> 32);
+    }
+
+    /**
+     * @brief Get the number of operations in flight.
+     */
+    inline int inflight() const { return this->slots.size() - this->free_slots.size(); }
+
+    /**
+     * @brief Poll every CQ once and dispatch the completions.
+     * @return int Number of completions dispatched, including those passed to the fallback.
+     */
+    int poll();
+
+    /**
+     * @brief Poll until the operation of a wr_id completes.
+     * Gives up if the pending WRs of an attached connection cannot be flushed for a reason other
+     * than a full send queue (e.g., the QP is in the error state), as they would never complete.
+     *
+     * @return int 0 once completed, or the status code of the failed flush (the operation stays
+     * in flight; `cancel` it, or `recover` the connection and wait again).
+     */
+    int wait(uint64_t wr_id);
+
+    /**
+     * @brief Get the status of the flush of attached connections before the last poll.
+     * @return int 0 if they left no WR pending, else the first status code returned by
+     * `ibv_exp_post_send` function.
+     */
+    inline int flush_status() const { return this->flush_error; }
+
+  private:
+    struct Slot {
+        uint32_t generation;  // Odd while in use
+        Continuation fn;
+        bool *done;
+        ibv_wc_status *status;
+    };
+
+    uint64_t acquire(Continuation &&fn, bool *done, ibv_wc_status *status);
+    void release(uint32_t index);
+    void dispatch(ibv_wc const &wc);
+    int flush();
+
+    std::vector<ibv_cq *> cqs;
+    std::vector<ReliableConnection *> rcs;
+    std::vector<ExtendedReliableConnection *> xrcs;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    Continuation fallback;
+    int flush_error;  // Of the flush before the last poll
+};
+
+}  // namespace rdma
+
+#endif  // __DISPATCHER_H__
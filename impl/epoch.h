@@ -0,0 +1,153 @@
+#if !defined(__EPOCH_H__)
+#define __EPOCH_H__
+
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace rdma {
+
+/**
+ * @brief Epoch-based reclamation for data read without locks on the post path.
+ * A reader enters a critical section by announcing the global epoch in a slot of its own (one
+ * cache line per thread), and leaves it by clearing the slot. A writer that unlinks an object
+ * retires it at the current epoch and advances the epoch; the object may be freed once no
+ * announced epoch is at or below its retire epoch, as readers that entered later cannot reach it.
+ * Readers never wait. A reader stalled inside a critical section (e.g., preempted) only delays
+ * reclamation, however long it stalls.
+ *
+ * Where the kernel supports `membarrier`, the store-load fence a reader needs between announcing
+ * and reading is issued by the writer on the reader's behalf, so readers only pay a few plain
+ * loads and stores; otherwise readers issue it themselves.
+ */
+class EpochDomain {
+  public:
+    /**
+     * @brief A reader critical section, for the lifetime of the guard. Guards may nest.
+     */
+    class Guard {
+      public:
+        inline Guard() : slot(EpochDomain::local_slot())
+        {
+            this->outer = this->slot->load(std::memory_order_relaxed);
+            if (this->outer != 0)
+                return;
+            EpochDomain &domain = EpochDomain::instance();
+            this->slot->store(domain.epoch.load(std::memory_order_acquire),
+                              std::memory_order_relaxed);
+            // Announce before reading anything protected; pairs with the fence in `min_active`
+            if (__glibc_likely(domain.asymmetric))
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            else
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        inline ~Guard()
+        {
+            if (this->outer == 0)
+                this->slot->store(0, std::memory_order_release);
+        }
+
+        Guard(Guard const &) = delete;
+        Guard(Guard &&) = delete;
+
+      private:
+        std::atomic<uint64_t> *slot;
+        uint64_t outer;  // Epoch announced by an enclosing guard, 0 if none
+    };
+
+    /**
+     * @brief Get the domain shared by all readers and writers of the process.
+     */
+    static inline EpochDomain &instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    /**
+     * @brief Advance the epoch after unlinking an object.
+     * @return uint64_t The epoch to retire the object at.
+     */
+    inline uint64_t retire() { return this->epoch.fetch_add(1, std::memory_order_seq_cst); }
+
+    /**
+     * @brief Get the oldest epoch announced by a reader in a critical section.
+     * Objects retired at an epoch below it are no longer referenced.
+     *
+     * @return uint64_t The oldest announced epoch, UINT64_MAX if no reader is in one.
+     */
+    inline uint64_t min_active()
+    {
+        if (this->asymmetric)
+            syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+        else
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        uint64_t min = UINT64_MAX;
+        for (auto &slot : this->slots) {
+            uint64_t e = slot.epoch.load(std::memory_order_acquire);
+            if (e != 0 && e < min)
+                min = e;
+        }
+        return min;
+    }
+
+  private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};  // 0 outside critical sections
+        bool used = false;
+    };
+
+    // Owns the slot of a thread until it exits
+    struct Registration {
+        Registration() : slot(EpochDomain::instance().acquire_slot()) {}
+        ~Registration() { EpochDomain::instance().release_slot(this->slot); }
+        Slot *slot;
+    };
+
+    EpochDomain() : epoch(1)
+    {
+        this->asymmetric =
+            syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+    }
+
+    static inline std::atomic<uint64_t> *local_slot()
+    {
+        static thread_local Registration registration;
+        return &registration.slot->epoch;
+    }
+
+    inline Slot *acquire_slot()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (auto &slot : this->slots)
+            if (!slot.used) {
+                slot.used = true;
+                return &slot;
+            }
+        this->slots.emplace_back();
+        this->slots.back().used = true;
+        return &this->slots.back();
+    }
+
+    inline void release_slot(Slot *slot)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        slot->epoch.store(0, std::memory_order_relaxed);
+        slot->used = false;
+    }
+
+    std::atomic<uint64_t> epoch;
+    bool asymmetric;  // Writers fence readers with `membarrier`
+    std::mutex mutex;
+    std::deque<Slot> slots;  // Never shrinks, so slot addresses stay valid
+};
+
+}  // namespace rdma
+
+#endif  // __EPOCH_H__
@@ -0,0 +1,141 @@
+#if !defined(__HW_CLOCK_H__)
+#define __HW_CLOCK_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "rdma_base.h"
+
+namespace rdma {
+
+/**
+ * @brief The free-running clock of the RNIC, which stamps completions of CQs created with
+ * timestamps (see `Cluster::set_cq_timestamps`), and its conversion to host time.
+ * Hardware timestamps count cycles of the HCA core clock and wrap around at `timestamp_mask`.
+ * Durations between two of them (e.g., from the send completion to the recv completion on the
+ * same RNIC) are exact; conversion to host time is anchored by `sync` and drifts with the skew
+ * between the two oscillators, so resync periodically (e.g., every second) for absolute times.
+ */
+class HwClock {
+  public:
+    HwClock() : ctx(nullptr), khz(0), mask(0), ref_cycles(0), ref_ns(0), ns_per_cycle(0) {}
+
+    /**
+     * @brief Set up from the device attributes, then `sync`.
+     */
+    inline void init(ibv_context *ctx, ibv_exp_device_attr const &attr)
+    {
+        this->ctx = ctx;
+        if (!(attr.comp_mask & IBV_EXP_DEVICE_ATTR_WITH_HCA_CORE_CLOCK) ||
+            attr.hca_core_clock == 0)
+            return;
+        this->khz = attr.hca_core_clock;
+        this->mask = (attr.comp_mask & IBV_EXP_DEVICE_ATTR_WITH_TIMESTAMP_MASK) &&
+                             attr.timestamp_mask != 0
+                         ? attr.timestamp_mask
+                         : UINT64_MAX;
+        this->ns_per_cycle = 1e6 / this->khz;
+        this->sync();
+    }
+
+    /**
+     * @brief Check whether the RNIC stamps completions.
+     */
+    inline bool supported() const { return this->khz != 0; }
+
+    /**
+     * @brief Re-anchor the conversion to host time: read the RNIC clock, and take the midpoint of
+     * the host clock readings around it. Not synchronized with conversions in other threads.
+     */
+    inline void sync()
+    {
+        if (!this->supported())
+            return;
+        ibv_exp_values values;
+        memset(&values, 0, sizeof(values));
+        values.comp_mask = IBV_EXP_VALUES_HW_CLOCK;
+        uint64_t before = host_ns();
+        if (ibv_exp_query_values(this->ctx, IBV_EXP_VALUES_HW_CLOCK, &values))
+            Emergency::abort("failed to read the RNIC clock");
+        uint64_t after = host_ns();
+        this->ref_cycles = values.hwclock;
+        this->ref_ns = before + (after - before) / 2;
+    }
+
+    /**
+     * @brief Convert a hardware timestamp to host time.
+     * @return uint64_t Nanoseconds on `std::chrono::steady_clock` (CLOCK_MONOTONIC).
+     */
+    inline uint64_t to_host_ns(uint64_t cycles) const
+    {
+        // Timestamps taken before the anchor show up as wrapped-around deltas
+        uint64_t delta = (cycles - this->ref_cycles) & this->mask;
+        if (delta > this->mask / 2)
+            return this->ref_ns - this->to_ns((this->ref_cycles - cycles) & this->mask);
+        return this->ref_ns + this->to_ns(delta);
+    }
+
+    /**
+     * @brief Get the nanoseconds elapsed between two hardware timestamps.
+     */
+    inline uint64_t elapsed_ns(uint64_t from_cycles, uint64_t to_cycles) const
+    {
+        return this->to_ns((to_cycles - from_cycles) & this->mask);
+    }
+
+    /**
+     * @brief Read the host clock in the unit of `to_host_ns`.
+     */
+    static inline uint64_t host_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+  private:
+    inline uint64_t to_ns(uint64_t cycles) const { return cycles * this->ns_per_cycle; }
+
+    ibv_context *ctx;
+    uint64_t khz;  // HCA core clock frequency, 0 if unsupported
+    uint64_t mask;
+    uint64_t ref_cycles;
+    uint64_t ref_ns;
+    double ns_per_cycle;
+};
+
+/**
+ * @brief Poll a CQ created with timestamps once, as `ibv_poll_cq` does, and convert the hardware
+ * timestamps to host time. At most 32 completions are polled.
+ *
+ * @param ts_arr Output, the host times of the completions, 0 where the RNIC gave none.
+ * @return int Number of completions polled, negative on failure.
+ */
+inline int poll_cq_timestamped(ibv_cq *cq, HwClock const &clock, ibv_wc *wc_arr, uint64_t *ts_arr,
+                               int n)
+{
+    ibv_exp_wc exp_wc_arr[32];
+    int res = ibv_exp_poll_cq(cq, std::min(n, 32), exp_wc_arr, sizeof(ibv_exp_wc));
+    for (int i = 0; i < res; ++i) {
+        ibv_exp_wc const &e = exp_wc_arr[i];
+        ibv_wc &wc = wc_arr[i];
+        memset(&wc, 0, sizeof(wc));
+        wc.wr_id = e.wr_id;
+        wc.status = e.status;
+        wc.opcode = static_cast<ibv_wc_opcode>(e.exp_opcode);
+        wc.vendor_err = e.vendor_err;
+        wc.byte_len = e.byte_len;
+        wc.imm_data = e.imm_data;
+        wc.qp_num = e.qp_num;
+        wc.src_qp = e.src_qp;
+        wc.wc_flags = (e.exp_wc_flags & IBV_EXP_WC_WITH_IMM) ? IBV_WC_WITH_IMM : 0;
+        ts_arr[i] = (e.exp_wc_flags & IBV_EXP_WC_WITH_TIMESTAMP) ? clock.to_host_ns(e.timestamp)
+                                                                 : 0;
+    }
+    return res;
+}
+
+}  // namespace rdma
+
+#endif  // __HW_CLOCK_H__
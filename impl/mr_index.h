@@ -0,0 +1,315 @@
+#if !defined(__MR_INDEX_H__)
+#define __MR_INDEX_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "epoch.h"
+
+namespace rdma {
+
+/**
+ * @brief Sorted interval index mapping address ranges of memory regions to their keys.
+ * Used by Context (lkey) and Peer (rkey) to resolve the key of every posted address range.
+ *
+ * Region start addresses are kept in a dense sorted array (8 per cache line), separate from the
+ * region ends and keys, so that the search only touches the start array. Lookup is a branchless
+ * binary search finding the region with the largest start address not above the queried address,
+ * so its cost grows logarithmically with the number of registered regions.
+ *
+ * A region starting at address 0 and spanning the whole address space (an implicit ODP MR) is not
+ * searched; it becomes the fallback matching every range that misses the other regions.
+ *
+ * Regions may overlap or nest (e.g., a buffer registered again inside a larger MR, or MRs of
+ * neighboring buffers sharing a page). Each entry keeps the largest end address among the
+ * regions up to it, so when the region found by the search does not contain the range, the
+ * search walks back only over the regions that still reach its end. Ranges inside a single region
+ * take the fast path without the walk.
+ */
+class MrIndex {
+  public:
+    /**
+     * @brief A region to insert.
+     */
+    struct Region {
+        uintptr_t addr;
+        size_t length;
+        uint32_t key;
+    };
+
+    /**
+     * @brief Insert a region into the index.
+     *
+     * @param addr Start address of the region.
+     * @param length Length in bytes of the region.
+     * @param key The key (lkey or rkey) returned on match.
+     */
+    inline void insert(uintptr_t addr, size_t length, uint32_t key)
+    {
+        if (addr == 0 && length == SIZE_MAX) {
+            has_fallback = true;
+            fallback = key;
+            return;
+        }
+
+        size_t pos = std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin();
+        starts.insert(starts.begin() + pos, addr);
+        entries.insert(entries.begin() + pos, Entry{addr + length, 0, key});
+        for (size_t i = pos; i < entries.size(); ++i)
+            entries[i].max_end = std::max(entries[i].end, i > 0 ? entries[i - 1].max_end : 0);
+    }
+
+    /**
+     * @brief Insert a batch of regions in one pass over the index.
+     * Same as inserting them one by one in order, but costs one merge instead of one shift each.
+     */
+    inline void insert(std::vector<Region> regions)
+    {
+        auto last = std::remove_if(regions.begin(), regions.end(), [this](Region const &r) {
+            if (r.addr != 0 || r.length != SIZE_MAX)
+                return false;
+            has_fallback = true;
+            fallback = r.key;
+            return true;
+        });
+        regions.erase(last, regions.end());
+        std::stable_sort(regions.begin(), regions.end(),
+                         [](Region const &a, Region const &b) { return a.addr < b.addr; });
+
+        std::vector<uintptr_t> merged_starts;
+        std::vector<Entry> merged_entries;
+        merged_starts.reserve(starts.size() + regions.size());
+        merged_entries.reserve(starts.size() + regions.size());
+        size_t i = 0;
+        for (auto const &r : regions) {
+            // Regions already indexed go first on equal starts, as with `upper_bound`
+            for (; i < starts.size() && starts[i] <= r.addr; ++i) {
+                merged_starts.push_back(starts[i]);
+                merged_entries.push_back(entries[i]);
+            }
+            merged_starts.push_back(r.addr);
+            merged_entries.push_back(Entry{r.addr + r.length, 0, r.key});
+        }
+        merged_starts.insert(merged_starts.end(), starts.begin() + i, starts.end());
+        merged_entries.insert(merged_entries.end(), entries.begin() + i, entries.end());
+
+        starts.swap(merged_starts);
+        entries.swap(merged_entries);
+        for (size_t j = 0; j < entries.size(); ++j)
+            entries[j].max_end = std::max(entries[j].end, j > 0 ? entries[j - 1].max_end : 0);
+    }
+
+    /**
+     * @brief Remove a region inserted with the same arguments, if any.
+     */
+    inline void erase(uintptr_t addr, size_t length, uint32_t key)
+    {
+        if (addr == 0 && length == SIZE_MAX) {
+            if (has_fallback && fallback == key)
+                has_fallback = false;
+            return;
+        }
+
+        size_t pos = std::lower_bound(starts.begin(), starts.end(), addr) - starts.begin();
+        for (; pos < starts.size() && starts[pos] == addr; ++pos)
+            if (entries[pos].end == addr + length && entries[pos].key == key)
+                break;
+        if (pos == starts.size() || starts[pos] != addr)
+            return;
+        starts.erase(starts.begin() + pos);
+        entries.erase(entries.begin() + pos);
+        for (size_t i = pos; i < entries.size(); ++i)
+            entries[i].max_end = std::max(entries[i].end, i > 0 ? entries[i - 1].max_end : 0);
+    }
+
+    /**
+     * @brief Remove all regions from the index.
+     */
+    inline void clear()
+    {
+        starts.clear();
+        entries.clear();
+        has_fallback = false;
+    }
+
+    /**
+     * @brief Get the number of indexed regions.
+     */
+    inline size_t size() const { return starts.size(); }
+
+    /**
+     * @brief Match an address range to an indexed region.
+     *
+     * @param addr Start address of the range.
+     * @param size Length in bytes of the range.
+     * @param key Output, the key of the matched region.
+     * @return true If the range lies entirely inside an indexed region.
+     */
+    inline bool lookup(uintptr_t addr, size_t size, uint32_t *key) const
+    {
+        size_t n = starts.size();
+        if (__glibc_unlikely(n == 0))
+            return lookup_fallback(key);
+
+        uintptr_t const *base = starts.data();
+        while (n > 1) {
+            size_t half = n >> 1;
+            base = (base[half] <= addr) ? base + half : base;  // Compiles to cmov
+            n -= half;
+        }
+
+        size_t i = base - starts.data();
+        *key = entries[i].key;
+        if (__glibc_likely(*base <= addr && addr + size <= entries[i].end))
+            return true;
+        if (*base <= addr && addr + size <= entries[i].max_end)
+            return lookup_enclosing(i, addr + size, key);
+        return lookup_fallback(key);
+    }
+
+  private:
+    // Walk back from entry i (starting at or below the range) to a region reaching `end`
+    inline bool lookup_enclosing(size_t i, uintptr_t end, uint32_t *key) const
+    {
+        for (;; --i) {
+            if (end <= entries[i].end) {
+                *key = entries[i].key;
+                return true;
+            }
+            if (i == 0 || entries[i - 1].max_end < end)
+                return lookup_fallback(key);
+        }
+    }
+
+    inline bool lookup_fallback(uint32_t *key) const
+    {
+        *key = fallback;
+        return has_fallback;
+    }
+
+    struct Entry {
+        uintptr_t end;
+        uintptr_t max_end;  // Largest end among entries up to this one
+        uint32_t key;
+    };
+
+    std::vector<uintptr_t> starts;
+    std::vector<Entry> entries;
+    bool has_fallback = false;
+    uint32_t fallback = 0;
+};
+
+/**
+ * @brief Versions of an MrIndex, read without locks on the post path.
+ * Inserted regions are queued, and the queue is merged into a copy of the index, which is then
+ * published atomically, when a lookup misses (or on `flush`). A burst of registrations thus costs
+ * one copy rather than one per region. Erased regions are removed at once. Lookups read the
+ * current version inside an `EpochDomain` critical section, and a replaced version is freed once
+ * no lookup can still be reading it.
+ */
+class MrIndexVersions {
+  public:
+    MrIndexVersions() : current(new MrIndex), npending(0) {}
+    ~MrIndexVersions() { delete this->current.load(std::memory_order_relaxed); }
+
+    MrIndexVersions(MrIndexVersions const &) = delete;
+    MrIndexVersions(MrIndexVersions &&) = delete;
+
+    /**
+     * @brief Match an address range in the current version, publishing queued regions first if
+     * it misses (see `MrIndex::lookup`).
+     */
+    inline bool lookup(uintptr_t addr, size_t size, uint32_t *key) const
+    {
+        do {
+            EpochDomain::Guard guard;
+            if (__glibc_likely(
+                    this->current.load(std::memory_order_acquire)->lookup(addr, size, key)))
+                return true;
+        } while (this->flush());
+        return false;
+    }
+
+    /**
+     * @brief Queue a region for insertion (see `MrIndex::insert`).
+     */
+    inline void insert(uintptr_t addr, size_t length, uint32_t key)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->pending.push_back({addr, length, key});
+        this->npending.store(this->pending.size(), std::memory_order_release);
+    }
+
+    /**
+     * @brief Remove a region and publish the result (see `MrIndex::erase`).
+     */
+    inline void erase(uintptr_t addr, size_t length, uint32_t key)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto index = this->copy();
+        index->erase(addr, length, key);
+        this->publish(std::move(index));
+    }
+
+    /**
+     * @brief Publish the queued regions.
+     * @return true If regions were queued (possibly published by another thread meanwhile).
+     */
+    inline bool flush() const
+    {
+        if (this->npending.load(std::memory_order_acquire) == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->pending.empty())
+            this->publish(this->copy());
+        return true;
+    }
+
+    /**
+     * @brief Get the number of replaced versions not freed yet.
+     */
+    inline size_t retired_count() const
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->retired.size();
+    }
+
+  private:
+    // Copy the current version with the queued regions merged in
+    inline std::unique_ptr<MrIndex> copy() const
+    {
+        std::unique_ptr<MrIndex> index(new MrIndex(*this->current.load(std::memory_order_relaxed)));
+        index->insert(this->pending);
+        this->pending.clear();
+        this->npending.store(0, std::memory_order_relaxed);
+        return index;
+    }
+
+    // Make a version current, retire the previous one, and free those no lookup can reach
+    inline void publish(std::unique_ptr<MrIndex> index) const
+    {
+        EpochDomain &domain = EpochDomain::instance();
+        MrIndex const *old = this->current.exchange(index.release(), std::memory_order_acq_rel);
+        this->retired.emplace_back(domain.retire(), std::unique_ptr<MrIndex const>(old));
+
+        uint64_t min = domain.min_active();
+        while (!this->retired.empty() && this->retired.front().first < min)
+            this->retired.pop_front();
+    }
+
+    mutable std::atomic<MrIndex const *> current;
+    mutable std::mutex mutex;
+    mutable std::vector<MrIndex::Region> pending;
+    mutable std::atomic<size_t> npending;
+    mutable std::deque<std::pair<uint64_t, std::unique_ptr<MrIndex const>>> retired;
+};
+
+}  // namespace rdma
+
+#endif  // __MR_INDEX_H__
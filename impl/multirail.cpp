@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "multirail.h"
+
+namespace rdma {
+
+MultiRail::MultiRail(std::vector<RailSpec> const &rails)
+    : stripe_threshold(DefaultStripeThreshold), policy(RailPolicy::ByPeer), next_rail(0)
+{
+    if (rails.empty())
+        Emergency::abort("no rails to use");
+
+    for (auto const &spec : rails) {
+        this->ctxs.emplace_back(new Context(spec.dev_name, spec.port, spec.gid_index));
+        this->clusters.emplace_back(new Cluster(*this->ctxs.back()));
+    }
+}
+
+MultiRail::~MultiRail()
+{
+    // Clusters reference their contexts
+    this->clusters.clear();
+    this->ctxs.clear();
+}
+
+void MultiRail::establish(int num_rc)
+{
+    for (auto &cluster : this->clusters)
+        cluster->establish(num_rc);
+}
+
+int MultiRail::reg_mr(void *addr, size_t size, int perm)
+{
+    std::vector<int> rail_ids;
+    for (auto &ctx : this->ctxs) {
+        int rail_id = ctx->reg_mr(addr, size, perm);
+        if (rail_id < 0) {
+            // Undo the rails registered so far
+            for (size_t i = 0; i < rail_ids.size(); ++i)
+                this->ctxs[i]->drop_mr(rail_ids[i]);
+            return -1;
+        }
+        rail_ids.push_back(rail_id);
+    }
+
+    std::lock_guard<std::mutex> lock(this->mr_mutex);
+    this->mr_ids.push_back(std::move(rail_ids));
+    return this->mr_ids.size() - 1;
+}
+
+int MultiRail::stripes(size_t size) const
+{
+    size_t n = this->ctxs.size();
+    if (n == 1 || size < this->stripe_threshold)
+        return 1;
+
+    size_t len = ((size + n - 1) / n + StripeAlign - 1) & ~(StripeAlign - 1);
+    return (size + len - 1) / len;
+}
+
+int MultiRail::pick_rail(int peer_id)
+{
+    switch (this->policy) {
+    case RailPolicy::ByPeer:
+        return peer_id % this->ctxs.size();
+    case RailPolicy::RoundRobin:
+        return this->next_rail.fetch_add(1, std::memory_order_relaxed) % this->ctxs.size();
+    default:
+        return 0;
+    }
+}
+
+int MultiRail::post_read(int peer_id, void *dst, uintptr_t src, size_t size, bool signaled,
+                         uint64_t wr_id, int rc_id)
+{
+    int n = this->stripes(size);
+    if (n == 1)
+        return this->rc(this->pick_rail(peer_id), peer_id, rc_id)
+            .post_read(dst, src, size, signaled, wr_id);
+
+    size_t len = (size + n - 1) / n;
+    len = (len + StripeAlign - 1) & ~(StripeAlign - 1);
+    for (int i = 0; i < n; ++i) {
+        size_t off = i * len;
+        int rc = this->rc(i, peer_id, rc_id)
+                     .post_read(reinterpret_cast<char *>(dst) + off, src + off,
+                                std::min(len, size - off), signaled, wr_id);
+        if (rc != 0)
+            return rc;
+    }
+    return 0;
+}
+
+int MultiRail::post_write(int peer_id, uintptr_t dst, void const *src, size_t size, bool signaled,
+                          uint64_t wr_id, int rc_id)
+{
+    int n = this->stripes(size);
+    if (n == 1)
+        return this->rc(this->pick_rail(peer_id), peer_id, rc_id)
+            .post_write(dst, src, size, signaled, wr_id);
+
+    size_t len = (size + n - 1) / n;
+    len = (len + StripeAlign - 1) & ~(StripeAlign - 1);
+    for (int i = 0; i < n; ++i) {
+        size_t off = i * len;
+        int rc = this->rc(i, peer_id, rc_id)
+                     .post_write(dst + off, reinterpret_cast<char const *>(src) + off,
+                                 std::min(len, size - off), signaled, wr_id);
+        if (rc != 0)
+            return rc;
+    }
+    return 0;
+}
+
+int MultiRail::poll_send_cq(int peer_id, int n, int rc_id)
+{
+    ibv_wc wc_arr[32];
+
+    int done = 0;
+    while (done < n) {
+        for (int rail = 0; rail < this->rails() && done < n; ++rail) {
+            int m = std::min(n - done, 32);
+            done += this->rc(rail, peer_id, rc_id).poll_send_cq_once(wc_arr, m);
+        }
+    }
+    return n;
+}
+
+}  // namespace rdma
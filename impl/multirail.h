@@ -0,0 +1,204 @@
+#if !defined(__MULTIRAIL_H__)
+#define __MULTIRAIL_H__
+
+#include <memory>
+#include <mutex>
+
+#include "rc/rc.h"
+
+namespace rdma {
+
+/**
+ * @brief A rail: one RDMA NIC port used by a MultiRail.
+ */
+struct RailSpec {
+    char const *dev_name;  // Name of the RDMA NIC device, nullptr for the first device
+    int port;              // Physical port number of the device
+    int gid_index;         // Index of the local GID of the port
+};
+
+/**
+ * @brief Policy choosing the rail of operations that are not striped.
+ */
+enum class RailPolicy {
+    ByPeer,      // Rail `peer_id % rails()`; keeps the order of small ops to each peer
+    RoundRobin,  // Rails in turn, spreading small ops at the cost of their ordering
+    First,       // Always rail 0
+};
+
+/**
+ * @brief Represent several RDMA NIC ports (rails) used together.
+ * Each rail has its own Context and Cluster, connected to the same rail of every peer, so all
+ * nodes must construct MultiRail objects with the same number of rails. Memory registered through
+ * the MultiRail is registered on every rail, and gets the same MR ID on all of them as long as
+ * rails are not registered on individually.
+ *
+ * READ/WRITE of at least the stripe threshold are split into one stripe per rail, posted on the
+ * RC of the same ID on each rail. Smaller ones go to a single rail chosen by the RailPolicy.
+ */
+class MultiRail {
+  public:
+    /**
+     * @brief Default minimum size of a striped READ/WRITE.
+     */
+    static const size_t DefaultStripeThreshold = 64ul << 10;
+
+    /**
+     * @brief Alignment of stripe boundaries.
+     */
+    static const size_t StripeAlign = 4096;
+
+    /**
+     * @brief Construct a Context and a Cluster for each rail.
+     *
+     * @warning MPI context must be already set-up.
+     * @param rails Specifications of the rails, at least one.
+     */
+    explicit MultiRail(std::vector<RailSpec> const &rails);
+
+    MultiRail(MultiRail const &) = delete;
+    MultiRail(MultiRail &&) = delete;
+
+    /**
+     * @brief On destruction, tears down the clusters before their contexts.
+     */
+    ~MultiRail();
+
+    /**
+     * @brief Establish RDMA RC connections to all peers on every rail.
+     *
+     * @param num_rc Number of RDMA RC connection(s) to establish per peer on each rail.
+     */
+    void establish(int num_rc = 1);
+
+    /**
+     * @brief Register a memory region on every rail.
+     *
+     * @param addr Start address of the memory region.
+     * @param size Length in bytes of the memory region.
+     * @param perm Access permission (defaulted to all necessary).
+     * @return int ID of the memory region in this MultiRail (see `mr_id`), -1 on any error, in
+     * which case no rail keeps it registered.
+     */
+    int reg_mr(void *addr, size_t size, int perm = 0xF);
+
+    /**
+     * @brief Get the ID that a rail's context (and its peers) gave a memory region, which may
+     * differ between rails, e.g., for `Context::local_span` or `Peer::remote_span` on that rail.
+     *
+     * @param rail The rail number.
+     * @param id ID of the memory region returned by `reg_mr`.
+     * @return int ID of the memory region on the rail.
+     */
+    inline int mr_id(int rail, int id) const
+    {
+        std::lock_guard<std::mutex> lock(this->mr_mutex);
+        return this->mr_ids[id][rail];
+    }
+
+    /**
+     * @brief Set the minimum size of a striped READ/WRITE.
+     */
+    inline void set_stripe_threshold(size_t bytes) { this->stripe_threshold = bytes; }
+
+    /**
+     * @brief Set the policy choosing the rail of operations that are not striped.
+     */
+    inline void set_policy(RailPolicy policy) { this->policy = policy; }
+
+    /**
+     * @brief Get the number of stripes (hence completions if signaled) a READ/WRITE is split into.
+     *
+     * @param size Bytes to read or write.
+     * @return int Number of stripes.
+     */
+    int stripes(size_t size) const;
+
+    /**
+     * @brief Choose the rail carrying an operation that is not striped.
+     *
+     * @param peer_id The ID (MPI rank) of the remote peer.
+     * @return int The rail number.
+     */
+    int pick_rail(int peer_id);
+
+    /**
+     * @brief Post RDMA one-sided READ, striped over all rails if large.
+     * If signaled, each stripe generates a completion on the send CQ of its rail.
+     *
+     * @param peer_id The ID (MPI rank) of the remote peer.
+     * @param dst Local virtual address. Must have been registered through the MultiRail.
+     * @param src Remote virtual address. Must have been registered by the peer.
+     * @param size Bytes to read.
+     * @param signaled If true, each stripe generates a completion.
+     * @param wr_id The work request ID of all stripes.
+     * @param rc_id The ID of the RC connection used on each rail.
+     * @return int The first non-zero status code returned by `ibv_post_send`, or 0.
+     */
+    int post_read(int peer_id, void *dst, uintptr_t src, size_t size, bool signaled = false,
+                  uint64_t wr_id = 0, int rc_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided WRITE, striped over all rails if large.
+     * If signaled, each stripe generates a completion on the send CQ of its rail.
+     *
+     * @param peer_id The ID (MPI rank) of the remote peer.
+     * @param dst Remote virtual address. Must have been registered by the peer.
+     * @param src Local virtual address. Must have been registered through the MultiRail.
+     * @param size Bytes to write.
+     * @param signaled If true, each stripe generates a completion.
+     * @param wr_id The work request ID of all stripes.
+     * @param rc_id The ID of the RC connection used on each rail.
+     * @return int The first non-zero status code returned by `ibv_post_send`, or 0.
+     */
+    int post_write(int peer_id, uintptr_t dst, void const *src, size_t size, bool signaled = false,
+                   uint64_t wr_id = 0, int rc_id = 0);
+
+    /**
+     * @brief Poll the send CQs of an RC connection on all rails until `n` completions arrive.
+     *
+     * @param peer_id The ID (MPI rank) of the remote peer.
+     * @param n Number of completions to wait for.
+     * @param rc_id The ID of the RC connection on each rail.
+     * @return int `n`.
+     */
+    int poll_send_cq(int peer_id, int n = 1, int rc_id = 0);
+
+    /**
+     * @brief Get the number of rails.
+     */
+    inline int rails() const { return this->ctxs.size(); }
+
+    /**
+     * @brief Get the RDMA context of a rail.
+     */
+    inline Context &context(int rail) const { return *this->ctxs[rail]; }
+
+    /**
+     * @brief Get the cluster of a rail.
+     */
+    inline Cluster &cluster(int rail) const { return *this->clusters[rail]; }
+
+    /**
+     * @brief Get an RC connection to a peer on a rail.
+     */
+    inline ReliableConnection &rc(int rail, int peer_id, int rc_id = 0) const
+    {
+        return this->clusters[rail]->peer(peer_id).rc(rc_id);
+    }
+
+  private:
+    std::vector<std::unique_ptr<Context>> ctxs;
+    std::vector<std::unique_ptr<Cluster>> clusters;
+
+    mutable std::mutex mr_mutex;
+    std::vector<std::vector<int>> mr_ids;  // Per MR, its ID on each rail
+
+    size_t stripe_threshold;
+    RailPolicy policy;
+    std::atomic<unsigned> next_rail;
+};
+
+}  // namespace rdma
+
+#endif  // __MULTIRAIL_H__
@@ -0,0 +1,204 @@
+#if !defined(__PAGES_H__)
+#define __PAGES_H__
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace rdma {
+
+/**
+ * @brief Page size backing memory allocated by `Context::alloc_mr`.
+ */
+enum class PageSize {
+    Default,      // Normal pages (usually 4 KB)
+    Transparent,  // Normal pages backed by transparent huge pages
+    Huge2M,       // 2 MB hugetlb pages
+    Huge1G,       // 1 GB hugetlb pages
+};
+
+/**
+ * @brief Anonymous memory mapped by `map_pages`. Release it with `munmap(addr, len)`.
+ */
+struct PageMapping {
+    void *addr;
+    size_t len;
+    PageSize page;  // Page size actually backing the memory
+};
+
+/**
+ * @brief Read the NUMA node of a device from sysfs.
+ *
+ * @param device_dir The device's sysfs directory, e.g., `/sys/class/infiniband/mlx5_0/device`.
+ * @return int The NUMA node, -1 if unknown (no `numa_node` file, unreadable, or -1 as reported on
+ * machines without NUMA).
+ */
+inline int numa_node_of(std::string const &device_dir)
+{
+    int node = -1;
+    FILE *fp = fopen((device_dir + "/numa_node").c_str(), "r");
+    if (fp == nullptr)
+        return -1;
+    if (fscanf(fp, "%d", &node) != 1 || node < 0)
+        node = -1;
+    fclose(fp);
+    return node;
+}
+
+/**
+ * @brief Check whether the mapping containing an address is entirely backed by transparent huge
+ * pages, after its pages are faulted in.
+ * The kernel may merge adjacent mappings with the same flags, in which case the whole merged
+ * mapping must be backed for this to hold.
+ *
+ * @param addr Address inside the mapping.
+ * @return true If the mapping is backed by transparent huge pages only.
+ */
+inline bool thp_backed(void const *addr)
+{
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (fp == nullptr)
+        return false;
+
+    uintptr_t target = reinterpret_cast<uintptr_t>(addr);
+    char line[512];
+    bool inside = false, found = false;
+    size_t vma_len = 0, huge_kb = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        // Mapping headers start with "start-end"; no field line matches both numbers
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            if (inside)
+                break;
+            inside = target >= start && target < end;
+            vma_len = end - start;
+            continue;
+        }
+        if (inside && sscanf(line, "AnonHugePages: %zu kB", &huge_kb) == 1) {
+            found = true;
+            break;
+        }
+    }
+    fclose(fp);
+    return found && huge_kb * 1024 >= vma_len;
+}
+
+/**
+ * @brief Map anonymous memory with the largest page size available up to `want`, bind it to a
+ * NUMA node and fault it in.
+ * Falls back from 1 GB to 2 MB hugetlb pages (when the pool is empty, or lacks pages on `numa`),
+ * then to normal pages advised to be backed by transparent huge pages, over-mapped and trimmed
+ * so that the range starts at a 2 MB boundary, as THP only backs aligned 2 MB ranges. `page` in
+ * the result reports what the kernel actually gave, not what was asked for.
+ *
+ * @param size Length in bytes, rounded up to the page size obtained (2 MB for THP).
+ * @param want Preferred page size.
+ * @param numa NUMA node to bind the memory to, -1 for none.
+ * @param out Output, the mapping.
+ * @return int 0 on success, otherwise the error code (e.g., from `mbind` if the memory cannot be
+ * bound to `numa`), with nothing left mapped.
+ */
+inline int map_pages(size_t size, PageSize want, int numa, PageMapping *out)
+{
+    static const size_t Size2M = 1ul << 21;
+    static const size_t Size1G = 1ul << 30;
+    static const size_t PageBytes = sysconf(_SC_PAGESIZE);
+
+    // Binds before the pages are faulted in
+    auto bind = [numa](void *addr, size_t len) {
+        if (numa < 0)
+            return 0;
+        unsigned long nodemask[16] = {0};
+        if (numa >= static_cast<int>(sizeof(nodemask) * 8))
+            return EINVAL;
+        nodemask[numa / 64] |= 1ul << (numa % 64);
+        if (syscall(SYS_mbind, addr, len, MPOL_BIND, nodemask, sizeof(nodemask) * 8,
+                    MPOL_MF_MOVE) != 0)
+            return errno;
+        return 0;
+    };
+
+    // Faults the pages in, reporting a shortage (hugetlb on the node) instead of dying of SIGBUS
+    auto populate = [](void *addr, size_t len, bool hugetlb) {
+#if defined(MADV_POPULATE_WRITE)
+        if (madvise(addr, len, MADV_POPULATE_WRITE) == 0)
+            return 0;
+        if (errno != EINVAL)
+            return errno;
+#endif
+        // Without MADV_POPULATE_WRITE, leave hugetlb pages to registration, which fails cleanly
+        if (!hugetlb)
+            for (size_t off = 0; off < len; off += PageBytes)
+                reinterpret_cast<volatile char *>(addr)[off] = 0;
+        return 0;
+    };
+
+    if (size == 0)
+        return EINVAL;
+
+    struct {
+        PageSize page;
+        size_t bytes;
+        int flag;
+    } hugetlb[] = {{PageSize::Huge1G, Size1G, 30 << MAP_HUGE_SHIFT},
+                   {PageSize::Huge2M, Size2M, 21 << MAP_HUGE_SHIFT}};
+    for (auto &h : hugetlb) {
+        if (want < h.page)
+            continue;
+        size_t len = (size + h.bytes - 1) & ~(h.bytes - 1);
+        void *addr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | h.flag, -1, 0);
+        if (addr == MAP_FAILED)
+            continue;
+        int err = bind(addr, len);
+        if (err != 0) {
+            munmap(addr, len);
+            return err;
+        }
+        if (populate(addr, len, true) != 0) {
+            munmap(addr, len);
+            continue;
+        }
+        *out = {addr, len, h.page};
+        return 0;
+    }
+
+    // Over-map by 2 MB, so that a 2 MB-aligned range fits, then trim both ends
+    bool huge = want != PageSize::Default;
+    size_t len = (size + (huge ? Size2M : PageBytes) - 1) & ~((huge ? Size2M : PageBytes) - 1);
+    size_t map_len = huge ? len + Size2M : len;
+    void *raw = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return errno;
+    char *addr = reinterpret_cast<char *>(raw);
+    if (huge) {
+        addr = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(raw) + Size2M - 1) &
+                                        ~(Size2M - 1));
+        if (addr != raw)
+            munmap(raw, addr - reinterpret_cast<char *>(raw));
+        size_t tail = reinterpret_cast<char *>(raw) + map_len - (addr + len);
+        if (tail)
+            munmap(addr + len, tail);
+        // A failure only means no THP, which `thp_backed` reports
+        madvise(addr, len, MADV_HUGEPAGE);
+    }
+
+    int err = bind(addr, len);
+    if (err == 0)
+        err = populate(addr, len, false);
+    if (err != 0) {
+        munmap(addr, len);
+        return err;
+    }
+    *out = {addr, len, thp_backed(addr) ? PageSize::Transparent : PageSize::Default};
+    return 0;
+}
+
+}  // namespace rdma
+
+#endif  // __PAGES_H__
@@ -1,5 +1,8 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
 
 #include "cluster.h"
 #include "context.h"
@@ -55,9 +58,7 @@ void Peer::establish(int num_rc, int num_xrc)
     OOBExchange xchg, remote_xchg;
     xchg.gid = this->ctx->gid;
     xchg.lid = this->ctx->port_attr.lid;
-    xchg.num_mr = this->ctx->nmrs;
-    for (int i = 0; i < this->ctx->nmrs; ++i)
-        xchg.mr[i] = *(this->ctx->mrs[i]);
+    xchg.num_mr = this->ctx->mr_count();
 
     xchg.num_rc = num_rc;
     for (int i = 0; i < num_rc; ++i)
@@ -70,14 +71,12 @@ void Peer::establish(int num_rc, int num_xrc)
     // Exchange connection metadata
     MPI_Status mpirc;
     int rc = MPI_Sendrecv(&xchg, 1, XchgQPInfoTy, this->id, 0, &remote_xchg, 1, XchgQPInfoTy,
-                          this->id, 0, MPI_COMM_WORLD, &mpirc);
+                          this->id, 0, this->cluster->comm, &mpirc);
     if (rc != MPI_SUCCESS)
         Emergency::abort("cannot perform MPI_Sendrecv with peer " + std::to_string(this->id));
 
-    // Store remote MR
-    this->nrmrs = remote_xchg.num_mr;
-    for (int i = 0; i < this->nrmrs; ++i)
-        this->remote_mrs[i] = remote_xchg.mr[i];
+    // Exchange and store remote MRs
+    this->exchange_mrs(xchg.num_mr, remote_xchg.num_mr);
 
     // Store remote XRC SRQ nums
     this->xrc_srq_nums.assign(num_xrc, 0);
@@ -101,13 +100,25 @@ void Peer::establish(int num_rc, int *share_cq_with)
             this->rcs[i] = new ReliableConnection(*this, i);
         else if (share_cq_with[i] > i)
             Emergency::abort("invalid share_cq_with");
-        else {
-            ibv_cq *send_cq = this->rcs[share_cq_with[i]]->get_send_cq();
-            ibv_cq *recv_cq = this->rcs[share_cq_with[i]]->get_recv_cq();
-            this->rcs[i] = new ReliableConnection(*this, i, send_cq, recv_cq);
-        }
+        else
+            this->rcs[i] = new ReliableConnection(*this, i, *this->rcs[share_cq_with[i]]);
     }
 
+    this->connect_rcs(num_rc);
+}
+
+void Peer::establish(int num_rc, std::vector<SharedCq *> const &shared_cqs)
+{
+    // Initiate connections
+    this->rcs.assign(num_rc, nullptr);
+    for (int i = 0; i < num_rc; ++i)
+        this->rcs[i] = new ReliableConnection(*this, i, *shared_cqs[i]);
+
+    this->connect_rcs(num_rc);
+}
+
+void Peer::connect_rcs(int num_rc)
+{
     // Prepare out-of-band connection metadata
     MPI_Datatype XchgQPInfoTy;
     MPI_Type_contiguous(sizeof(OOBExchange), MPI_BYTE, &XchgQPInfoTy);
@@ -116,9 +127,7 @@ void Peer::establish(int num_rc, int *share_cq_with)
     OOBExchange xchg, remote_xchg;
     xchg.gid = this->ctx->gid;
     xchg.lid = this->ctx->port_attr.lid;
-    xchg.num_mr = this->ctx->nmrs;
-    for (int i = 0; i < this->ctx->nmrs; ++i)
-        xchg.mr[i] = *(this->ctx->mrs[i]);
+    xchg.num_mr = this->ctx->mr_count();
 
     xchg.num_rc = num_rc;
     for (int i = 0; i < num_rc; ++i)
@@ -127,18 +136,75 @@ void Peer::establish(int num_rc, int *share_cq_with)
     // Exchange connection metadata
     MPI_Status mpirc;
     int rc = MPI_Sendrecv(&xchg, 1, XchgQPInfoTy, this->id, 0, &remote_xchg, 1, XchgQPInfoTy,
-                          this->id, 0, MPI_COMM_WORLD, &mpirc);
+                          this->id, 0, this->cluster->comm, &mpirc);
     if (rc != MPI_SUCCESS)
         Emergency::abort("cannot perform MPI_Sendrecv with peer " + std::to_string(this->id));
 
-    // Store remote MR
-    this->nrmrs = remote_xchg.num_mr;
-    for (int i = 0; i < this->nrmrs; ++i)
-        this->remote_mrs[i] = remote_xchg.mr[i];
+    // Exchange and store remote MRs
+    this->exchange_mrs(xchg.num_mr, remote_xchg.num_mr);
 
     // Connect
     for (int i = 0; i < num_rc; ++i)
         this->rcs[i]->establish(remote_xchg.gid, remote_xchg.lid, remote_xchg.rc_qp_num[i]);
 }
 
+void Peer::exchange_mrs(int local_num_mr, int remote_num_mr)
+{
+    // MRs registered after counting are not exchanged
+    std::vector<ibv_mr> local_mrs;
+    {
+        std::lock_guard<std::mutex> lock(this->ctx->mr_mutex);
+        for (int i = 0; i < local_num_mr; ++i) {
+            // Dropped MRs keep their IDs as empty regions
+            ibv_mr *mr = this->ctx->mrs[i];
+            local_mrs.push_back(mr ? *mr : ibv_mr{});
+        }
+    }
+
+    std::vector<ibv_mr> remote_mrs(remote_num_mr);
+    MPI_Status mpirc;
+    int rc = MPI_Sendrecv(local_mrs.data(), local_mrs.size() * sizeof(ibv_mr), MPI_BYTE, this->id,
+                          1, remote_mrs.data(), remote_num_mr * sizeof(ibv_mr), MPI_BYTE, this->id,
+                          1, this->cluster->comm, &mpirc);
+    if (rc != MPI_SUCCESS)
+        Emergency::abort("cannot exchange MRs with peer " + std::to_string(this->id));
+
+    this->add_remote_mrs(remote_mrs.data(), remote_num_mr);
+}
+
+void Peer::add_remote_mrs(ibv_mr const *mrs, int count)
+{
+    std::lock_guard<std::mutex> lock(this->remote_mr_mutex);
+
+    for (int i = 0; i < count; ++i)
+        if (mrs[i].length > 0)
+            this->remote_mr_index.insert(reinterpret_cast<uintptr_t>(mrs[i].addr), mrs[i].length,
+                                         mrs[i].rkey);
+
+    this->remote_mrs.insert(this->remote_mrs.end(), mrs, mrs + count);
+}
+
+uint32_t Peer::match_published_mr_rkey(void const *addr, size_t size) const
+{
+    // A publication may still be in flight when its address is used, so wait for it a while.
+    // Threads that may not call MPI leave receiving it to one that may
+    bool poll = this->cluster->may_call_mpi();
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::microseconds(this->cluster->mr_wait_us.load());
+    auto backoff = std::chrono::microseconds(1);
+    while (true) {
+        // Another thread may have received it already, so look up whatever the poll returns
+        uint32_t rkey;
+        if (poll)
+            this->cluster->poll_mr_updates();
+        if (this->remote_mr_index.lookup(reinterpret_cast<uintptr_t>(addr), size, &rkey))
+            return rkey;
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+    }
+    Emergency::abort("cannot match remote mr");
+}
+
 }  // namespace rdma
@@ -1,7 +1,12 @@
 #if !defined(__PEER_H__)
 #define __PEER_H__
 
+#include <memory>
+#include <mutex>
+
+#include "mr_index.h"
 #include "rdma_base.h"
+#include "span.h"
 
 namespace rdma {
 
@@ -17,9 +22,8 @@ class OOBExchange {
     ibv_gid gid;
     uint16_t lid;
 
-    // RDMA MRs (for single-sided verbs)
+    // RDMA MRs (for single-sided verbs), the MRs themselves are exchanged afterwards
     int num_mr;
-    ibv_mr mr[Consts::MaxMrs];
 
     // RDMA RC connection QP info
     int num_rc;
@@ -63,16 +67,54 @@ class Peer {
 
     /**
      * @brief Get the memory region registered by remote side.
+     * MRs published by the peer after `Cluster::establish` are appended in publication order.
      *
      * @param id ID of the memory region (default to 0).
      * @return std::pair<uintptr_t, size_t> Address and length of the memory region.
      */
     inline std::pair<uintptr_t, size_t> remote_mr(int id = 0) const
     {
+        std::lock_guard<std::mutex> lock(this->remote_mr_mutex);
         return {reinterpret_cast<uintptr_t>(this->remote_mrs[id].addr),
                 this->remote_mrs[id].length};
     }
 
+    /**
+     * @brief Resolve the rkey of a remote buffer once, for repeated posts.
+     * Dies if the buffer is not covered by a memory region registered by remote side.
+     *
+     * @param addr Start address of the remote buffer.
+     * @param size Length in bytes of the remote buffer.
+     * @return RemoteSpan The remote buffer with its rkey.
+     */
+    inline RemoteSpan remote_span(uintptr_t addr, size_t size) const
+    {
+        return {addr, size, this->match_remote_mr_rkey(addr, size)};
+    }
+
+    /**
+     * @brief Get a whole memory region registered by remote side as a remote span.
+     *
+     * @param id ID of the memory region (default to 0).
+     * @return RemoteSpan The memory region with its rkey.
+     */
+    inline RemoteSpan remote_span(int id = 0) const
+    {
+        std::lock_guard<std::mutex> lock(this->remote_mr_mutex);
+        return {reinterpret_cast<uintptr_t>(this->remote_mrs[id].addr),
+                this->remote_mrs[id].length, this->remote_mrs[id].rkey};
+    }
+
+    /**
+     * @brief Get the count of memory regions known to be registered by remote side.
+     * @return size_t Count of remote memory regions.
+     */
+    inline size_t remote_mr_count() const
+    {
+        std::lock_guard<std::mutex> lock(this->remote_mr_mutex);
+        return this->remote_mrs.size();
+    }
+
     /**
      * @brief Get the reference of an RDMA RC connection with certain ID.
      * If the ID is not specified, return the first RC connection.
@@ -112,46 +154,42 @@ class Peer {
 
     void establish(int num_rc, int num_xrc);
     void establish(int num_rc, int *share_cq_with);
+    void establish(int num_rc, std::vector<SharedCq *> const &shared_cqs);
+
+    /**
+     * @brief Exchange RC QP info with the peer and connect the RCs (after creating them).
+     */
+    void connect_rcs(int num_rc);
+
+    /**
+     * @brief Exchange the MR lists with the peer (after `OOBExchange` told their counts).
+     */
+    void exchange_mrs(int local_num_mr, int remote_num_mr);
+
+    /**
+     * @brief Append remote MRs and queue them for the rkey index, which publishes them all in one
+     * new version at the next lookup that misses (see `MrIndexVersions`).
+     */
+    void add_remote_mrs(ibv_mr const *mrs, int count);
 
     /**
      * @brief Match a given remote address range to MR and return its rkey.
      */
     inline uint32_t match_remote_mr_rkey(void const *addr, size_t size = 0) const
     {
-        switch (this->nrmrs) {
-        case 4:
-            if (addr >= this->remote_mrs[3].addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->remote_mrs[3].addr) +
-                        this->remote_mrs[3].length)
-                return this->remote_mrs[3].rkey;
-            [[fallthrough]];
-        case 3:
-            if (addr >= this->remote_mrs[2].addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->remote_mrs[2].addr) +
-                        this->remote_mrs[2].length)
-                return this->remote_mrs[2].rkey;
-            [[fallthrough]];
-        case 2:
-            if (addr >= this->remote_mrs[1].addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->remote_mrs[1].addr) +
-                        this->remote_mrs[1].length)
-                return this->remote_mrs[1].rkey;
-            [[fallthrough]];
-        case 1:
-            if (addr >= this->remote_mrs[0].addr &&
-                reinterpret_cast<char const *>(addr) + size <=
-                    reinterpret_cast<char const *>(this->remote_mrs[0].addr) +
-                        this->remote_mrs[0].length)
-                return this->remote_mrs[0].rkey;
-            [[fallthrough]];
-        default:
-            Emergency::abort("cannot match remote mr");
-        }
+        uint32_t rkey;
+        if (__glibc_likely(
+                this->remote_mr_index.lookup(reinterpret_cast<uintptr_t>(addr), size, &rkey)))
+            return rkey;
+        return this->match_published_mr_rkey(addr, size);
     }
 
+    /**
+     * @brief Slow path of `match_remote_mr_rkey`: wait up to `Cluster::set_mr_wait` for the MR to
+     * be published, receiving publications itself if this thread may call MPI.
+     */
+    uint32_t match_published_mr_rkey(void const *addr, size_t size) const;
+
     /**
      * @brief Match a given remote address range to MR and return its rkey.
      */
@@ -163,8 +201,10 @@ class Peer {
     Cluster *cluster;
     Context *ctx;
     int id;
-    int nrmrs;
-    std::array<ibv_mr, Consts::MaxMrs> remote_mrs;
+
+    mutable std::mutex remote_mr_mutex;
+    std::vector<ibv_mr> remote_mrs;
+    MrIndexVersions remote_mr_index;
 
     std::vector<ReliableConnection *> rcs;
     std::vector<ExtendedReliableConnection *> xrcs;
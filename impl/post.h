@@ -0,0 +1,125 @@
+#if !defined(__POST_H__)
+#define __POST_H__
+
+#include "rdma_base.h"
+#include "span.h"
+
+namespace rdma {
+
+/**
+ * @brief Work request builders specialized at compile time for an opcode and send flags.
+ * Every branch on the opcode, the flags and the WR layout is resolved by the compiler, so a post
+ * through `ReliableConnection::post<...>` or `ExtendedReliableConnection::post<...>` inlines into
+ * the caller as a handful of stores followed by `ibv_exp_post_send`.
+ *
+ * Only the fields that `ibv_exp_post_send` reads for the opcode are stored, rather than zeroing
+ * the whole (several cache lines long) `ibv_exp_send_wr` first. The others, e.g., `ex.imm_data`,
+ * `ext_op` and the `wr` union for SEND, are left as they are: they are read only for opcodes,
+ * flags or QP types that these builders do not produce. Do not pass a WR built here to code that
+ * expects the rest to be zero.
+ *
+ * Supported opcodes are RDMA READ/WRITE, SEND and atomic CAS/FAA. `Flags` is a combination of
+ * `IBV_EXP_SEND_SIGNALED`, `IBV_EXP_SEND_FENCE` and `IBV_EXP_SEND_INLINE`. With
+ * `IBV_EXP_SEND_INLINE`, the payload must not exceed the connection's `inline_threshold()`.
+ *
+ * @tparam Opcode Opcode of the work request.
+ * @tparam Flags Send flags of the work request.
+ */
+template <ibv_exp_wr_opcode Opcode, unsigned Flags = IBV_EXP_SEND_SIGNALED>
+class StaticWr {
+  public:
+    static constexpr bool IsRdma =
+        Opcode == IBV_EXP_WR_RDMA_READ || Opcode == IBV_EXP_WR_RDMA_WRITE;
+    static constexpr bool IsSend = Opcode == IBV_EXP_WR_SEND;
+    static constexpr bool IsAtomic =
+        Opcode == IBV_EXP_WR_ATOMIC_CMP_AND_SWP || Opcode == IBV_EXP_WR_ATOMIC_FETCH_AND_ADD;
+
+    static_assert(IsRdma || IsSend || IsAtomic, "unsupported opcode");
+    static_assert(!(Flags & IBV_EXP_SEND_INLINE) || Opcode == IBV_EXP_WR_RDMA_WRITE || IsSend,
+                  "only WRITE and SEND can be inline");
+    static_assert((Flags & ~(IBV_EXP_SEND_SIGNALED | IBV_EXP_SEND_FENCE | IBV_EXP_SEND_INLINE)) ==
+                      0,
+                  "unsupported send flags");
+
+    /**
+     * @brief Build a one-sided READ/WRITE.
+     *
+     * @param wr The work request to fill.
+     * @param sge The scatter/gather element to fill, referred to by `wr`.
+     * @param remote The remote buffer (source of READ, destination of WRITE).
+     * @param local The local buffer (destination of READ, source of WRITE). Its size is posted.
+     * @param wr_id The work request ID.
+     * @param xrc_srq_num The remote XRC SRQ number (0 for non-XRC QPs).
+     */
+    static inline void fill(ibv_exp_send_wr *wr, ibv_sge *sge, RemoteSpan const &remote,
+                            LocalSpan const &local, uint64_t wr_id, uint32_t xrc_srq_num = 0)
+    {
+        static_assert(IsRdma, "fill(remote, local) needs a READ/WRITE opcode");
+        fill_common(wr, sge, local, local.size, wr_id, xrc_srq_num);
+        wr->wr.rdma.remote_addr = remote.addr;
+        wr->wr.rdma.rkey = remote.rkey;
+    }
+
+    /**
+     * @brief Build a SEND.
+     *
+     * @param wr The work request to fill.
+     * @param sge The scatter/gather element to fill, referred to by `wr`.
+     * @param local The local buffer to send.
+     * @param wr_id The work request ID.
+     * @param xrc_srq_num The remote XRC SRQ number (0 for non-XRC QPs).
+     */
+    static inline void fill(ibv_exp_send_wr *wr, ibv_sge *sge, LocalSpan const &local,
+                            uint64_t wr_id, uint32_t xrc_srq_num = 0)
+    {
+        static_assert(IsSend, "fill(local) needs the SEND opcode");
+        fill_common(wr, sge, local, local.size, wr_id, xrc_srq_num);
+    }
+
+    /**
+     * @brief Build an atomic CAS/FAA. The remote address must be 8-byte aligned.
+     *
+     * @param wr The work request to fill.
+     * @param sge The scatter/gather element to fill, referred to by `wr`.
+     * @param remote The remote 8-byte target.
+     * @param local The local 8-byte buffer receiving the original remote value.
+     * @param compare_add The compare value (CAS) or the addend (FAA).
+     * @param swap The swap value (CAS only).
+     * @param wr_id The work request ID.
+     * @param xrc_srq_num The remote XRC SRQ number (0 for non-XRC QPs).
+     */
+    static inline void fill_atomic(ibv_exp_send_wr *wr, ibv_sge *sge, RemoteSpan const &remote,
+                                   LocalSpan const &local, uint64_t compare_add, uint64_t swap,
+                                   uint64_t wr_id, uint32_t xrc_srq_num = 0)
+    {
+        static_assert(IsAtomic, "fill_atomic needs a CAS/FAA opcode");
+        fill_common(wr, sge, local, sizeof(uint64_t), wr_id, xrc_srq_num);
+        wr->wr.atomic.remote_addr = remote.addr;
+        wr->wr.atomic.rkey = remote.rkey;
+        wr->wr.atomic.compare_add = compare_add;
+        if constexpr (Opcode == IBV_EXP_WR_ATOMIC_CMP_AND_SWP)
+            wr->wr.atomic.swap = swap;
+    }
+
+  private:
+    static inline void fill_common(ibv_exp_send_wr *wr, ibv_sge *sge, LocalSpan const &local,
+                                   size_t length, uint64_t wr_id, uint32_t xrc_srq_num)
+    {
+        sge->addr = local.uaddr();
+        sge->length = length;
+        sge->lkey = local.lkey;
+
+        wr->next = nullptr;
+        wr->wr_id = wr_id;
+        wr->sg_list = sge;
+        wr->num_sge = 1;
+        wr->exp_opcode = Opcode;
+        wr->exp_send_flags = Flags;
+        wr->xrc_remote_srq_num = xrc_srq_num;
+        wr->comp_mask = 0;
+    }
+};
+
+}  // namespace rdma
+
+#endif  // __POST_H__
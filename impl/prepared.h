@@ -0,0 +1,155 @@
+#if !defined(__PREPARED_H__)
+#define __PREPARED_H__
+
+#include <cstring>
+
+#include "rdma_base.h"
+#include "span.h"
+
+namespace rdma {
+
+/**
+ * @brief A work request template prepared once for a connection and an opcode.
+ * Obtain one from `ReliableConnection::prepare` or `ExtendedReliableConnection::prepare`. Every
+ * field that does not change between posts (opcode, flags, QP, XRC SRQ) is filled in advance, so
+ * issuing only patches the addresses, keys, length and wr_id, without any memset or MR lookup.
+ *
+ * Supported opcodes are RDMA READ/WRITE, SEND, atomic CAS and atomic FAA. A PreparedOp may be
+ * copied freely, but must not be posted by several threads at a time.
+ */
+class PreparedOp {
+  public:
+    PreparedOp() : qp(nullptr) {}
+
+    /**
+     * @brief Prepare a work request template.
+     *
+     * @param qp The QP to post to.
+     * @param opcode Opcode of the work request.
+     * @param signaled If true, every post generates a completion.
+     * @param xrc_srq_num The remote XRC SRQ number (0 for non-XRC QPs).
+     */
+    PreparedOp(ibv_qp *qp, ibv_exp_wr_opcode opcode, bool signaled, uint32_t xrc_srq_num = 0)
+        : qp(qp)
+    {
+        memset(&this->wr, 0, sizeof(this->wr));
+        this->wr.num_sge = 1;
+        this->wr.exp_opcode = opcode;
+        this->wr.exp_send_flags = signaled ? IBV_EXP_SEND_SIGNALED : 0;
+        this->wr.xrc_remote_srq_num = xrc_srq_num;
+        if (opcode == IBV_EXP_WR_ATOMIC_CMP_AND_SWP || opcode == IBV_EXP_WR_ATOMIC_FETCH_AND_ADD)
+            this->sge.length = sizeof(uint64_t);
+    }
+
+    /**
+     * @brief Patch the template for a one-sided READ/WRITE, without posting it.
+     *
+     * @param remote The remote buffer (source of READ, destination of WRITE).
+     * @param local The local buffer (destination of READ, source of WRITE). Its size is posted.
+     * @param wr_id The work request ID.
+     * @return ibv_exp_send_wr* The patched work request.
+     */
+    inline ibv_exp_send_wr *patch(RemoteSpan const &remote, LocalSpan const &local,
+                                  uint64_t wr_id = 0)
+    {
+        this->sge.addr = local.uaddr();
+        this->sge.length = local.size;
+        this->sge.lkey = local.lkey;
+        this->wr.sg_list = &this->sge;
+        this->wr.wr_id = wr_id;
+        this->wr.wr.rdma.remote_addr = remote.addr;
+        this->wr.wr.rdma.rkey = remote.rkey;
+        return &this->wr;
+    }
+
+    /**
+     * @brief Patch the template for a SEND, without posting it.
+     *
+     * @param local The local buffer to send.
+     * @param wr_id The work request ID.
+     * @return ibv_exp_send_wr* The patched work request.
+     */
+    inline ibv_exp_send_wr *patch(LocalSpan const &local, uint64_t wr_id = 0)
+    {
+        this->sge.addr = local.uaddr();
+        this->sge.length = local.size;
+        this->sge.lkey = local.lkey;
+        this->wr.sg_list = &this->sge;
+        this->wr.wr_id = wr_id;
+        return &this->wr;
+    }
+
+    /**
+     * @brief Patch the template for an atomic CAS/FAA, without posting it.
+     *
+     * @param remote The remote 8-byte target.
+     * @param local The local 8-byte buffer receiving the original remote value.
+     * @param compare_add The compare value (CAS) or the addend (FAA).
+     * @param swap The swap value (CAS only).
+     * @param wr_id The work request ID.
+     * @return ibv_exp_send_wr* The patched work request.
+     */
+    inline ibv_exp_send_wr *patch_atomic(RemoteSpan const &remote, LocalSpan const &local,
+                                         uint64_t compare_add, uint64_t swap = 0,
+                                         uint64_t wr_id = 0)
+    {
+        this->sge.addr = local.uaddr();
+        this->sge.lkey = local.lkey;
+        this->wr.sg_list = &this->sge;
+        this->wr.wr_id = wr_id;
+        this->wr.wr.atomic.remote_addr = remote.addr;
+        this->wr.wr.atomic.rkey = remote.rkey;
+        this->wr.wr.atomic.compare_add = compare_add;
+        this->wr.wr.atomic.swap = swap;
+        return &this->wr;
+    }
+
+    /**
+     * @brief Post a one-sided READ/WRITE. See `patch`.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    inline int post(RemoteSpan const &remote, LocalSpan const &local, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr *bad_wr;
+        return ibv_exp_post_send(this->qp, this->patch(remote, local, wr_id), &bad_wr);
+    }
+
+    /**
+     * @brief Post a SEND. See `patch`.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    inline int post(LocalSpan const &local, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr *bad_wr;
+        return ibv_exp_post_send(this->qp, this->patch(local, wr_id), &bad_wr);
+    }
+
+    /**
+     * @brief Post an atomic CAS/FAA. See `patch_atomic`.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    inline int post_atomic(RemoteSpan const &remote, LocalSpan const &local, uint64_t compare_add,
+                           uint64_t swap = 0, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr *bad_wr;
+        return ibv_exp_post_send(
+            this->qp, this->patch_atomic(remote, local, compare_add, swap, wr_id), &bad_wr);
+    }
+
+    /**
+     * @brief Change whether posts generate completions.
+     */
+    inline void set_signaled(bool signaled)
+    {
+        this->wr.exp_send_flags = signaled ? IBV_EXP_SEND_SIGNALED : 0;
+    }
+
+  private:
+    ibv_qp *qp;
+    ibv_exp_send_wr wr;
+    ibv_sge sge;  // Re-pointed by every patch, so that copies stay valid
+};
+
+}  // namespace rdma
+
+#endif  // __PREPARED_H__
@@ -13,15 +13,21 @@ ReliableConnection::ReliableConnection(Peer &peer, int id)
 
     this->peer = &peer;
     this->id = id;
+    this->in_error = false;
+    this->flush_error = 0;
 
     // Create QP
     this->cq_self = true;
-    this->create_cq(&this->send_cq);
-    this->create_cq(&this->recv_cq);
+    if (this->cluster->cq_channels) {
+        this->send_channel.open(this->ctx->ctx);
+        this->recv_channel.open(this->ctx->ctx);
+    }
+    this->create_cq(&this->send_cq, this->send_channel.get());
+    this->create_cq(&this->recv_cq, this->recv_channel.get());
     this->create_qp();
 }
 
-ReliableConnection::ReliableConnection(Peer &peer, int id, ibv_cq *send_cq, ibv_cq *recv_cq)
+ReliableConnection::ReliableConnection(Peer &peer, int id, ReliableConnection const &cq_owner)
 {
     this->ctx = peer.ctx;
     this->ctx->refcnt.fetch_add(1);
@@ -29,20 +35,47 @@ ReliableConnection::ReliableConnection(Peer &peer, int id, ibv_cq *send_cq, ibv_
 
     this->peer = &peer;
     this->id = id;
+    this->in_error = false;
+    this->flush_error = 0;
 
     // Create QP
     this->cq_self = false;
-    this->send_cq = send_cq;
-    this->recv_cq = recv_cq;
+    this->send_cq = cq_owner.send_cq;
+    this->recv_cq = cq_owner.recv_cq;
+    this->send_channel = cq_owner.send_channel;
+    this->recv_channel = cq_owner.recv_channel;
     this->create_qp();
 }
 
+ReliableConnection::ReliableConnection(Peer &peer, int id, SharedCq &shared_cq)
+{
+    this->ctx = peer.ctx;
+    this->ctx->refcnt.fetch_add(1);
+    this->cluster = peer.cluster;
+
+    this->peer = &peer;
+    this->id = id;
+    this->in_error = false;
+    this->flush_error = 0;
+
+    // Create QP on the CQs shared across peers
+    this->cq_self = false;
+    this->send_cq = shared_cq.send_cq;
+    this->recv_cq = shared_cq.recv_cq;
+    this->send_channel = shared_cq.send_channel;
+    this->recv_channel = shared_cq.recv_channel;
+    this->create_qp();
+    shared_cq.add(this, this->qp->qp_num, peer.id);
+}
+
 ReliableConnection::~ReliableConnection()
 {
     ibv_destroy_qp(this->qp);
     if (this->cq_self) {
         ibv_destroy_cq(this->send_cq);
         ibv_destroy_cq(this->recv_cq);
+        this->send_channel.close();
+        this->recv_channel.close();
     }
 
     // Dereference the RDMA context
@@ -52,147 +85,291 @@ ReliableConnection::~ReliableConnection()
 int ReliableConnection::post_read(void *dst, uintptr_t src, size_t size, bool signaled,
                                   uint64_t wr_id)
 {
-    ibv_send_wr wr, *bad_wr;
+    return this->post_read(this->ctx->local_span(dst, size), this->peer->remote_span(src, size),
+                           signaled, wr_id);
+}
+
+int ReliableConnection::post_read(LocalSpan const &dst, RemoteSpan const &src, bool signaled,
+                                  uint64_t wr_id)
+{
+    if (signaled)
+        return this->post<IBV_EXP_WR_RDMA_READ>(src, dst, wr_id);
+    return this->post<IBV_EXP_WR_RDMA_READ, 0>(src, dst, wr_id);
+}
+
+int ReliableConnection::post_write(uintptr_t dst, void const *src, size_t size, bool signaled,
+                                   uint64_t wr_id)
+{
+    if (size <= this->max_inline)
+        return this->post_write(this->peer->remote_span(dst, size),
+                                LocalSpan{const_cast<void *>(src), size, 0}, signaled, wr_id);
+    return this->post_write(this->peer->remote_span(dst, size),
+                            this->ctx->local_span(const_cast<void *>(src), size), signaled, wr_id);
+}
+
+int ReliableConnection::post_write(RemoteSpan const &dst, LocalSpan const &src, bool signaled,
+                                   uint64_t wr_id)
+{
+    if (src.size > this->max_inline) {
+        if (signaled)
+            return this->post<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_SIGNALED>(dst, src, wr_id);
+        return this->post<IBV_EXP_WR_RDMA_WRITE, 0>(dst, src, wr_id);
+    }
+    if (signaled)
+        return this->post<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_SIGNALED | IBV_EXP_SEND_INLINE>(
+            dst, src, wr_id);
+    return this->post<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_INLINE>(dst, src, wr_id);
+}
+
+int ReliableConnection::post_send(void const *src, size_t size, bool signaled, uint64_t wr_id)
+{
+    if (size <= this->max_inline)
+        return this->post_send(LocalSpan{const_cast<void *>(src), size, 0}, signaled, wr_id);
+    return this->post_send(this->ctx->local_span(const_cast<void *>(src), size), signaled, wr_id);
+}
+
+int ReliableConnection::post_send(LocalSpan const &src, bool signaled, uint64_t wr_id)
+{
+    if (src.size > this->max_inline) {
+        if (signaled)
+            return this->post<IBV_EXP_WR_SEND, IBV_EXP_SEND_SIGNALED>(src, wr_id);
+        return this->post<IBV_EXP_WR_SEND, 0>(src, wr_id);
+    }
+    if (signaled)
+        return this->post<IBV_EXP_WR_SEND, IBV_EXP_SEND_SIGNALED | IBV_EXP_SEND_INLINE>(src, wr_id);
+    return this->post<IBV_EXP_WR_SEND, IBV_EXP_SEND_INLINE>(src, wr_id);
+}
+
+int ReliableConnection::post_recv(void *dst, size_t size, uint64_t wr_id)
+{
+    return this->post_recv(this->ctx->local_span(dst, size), wr_id);
+}
+
+int ReliableConnection::post_recv(LocalSpan const &dst, uint64_t wr_id)
+{
+    ibv_recv_wr wr, *bad_wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(dst);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(dst, size);
+    sge.addr = dst.uaddr();
+    sge.length = dst.size;
+    sge.lkey = dst.lkey;
 
     memset(&wr, 0, sizeof(wr));
     wr.next = nullptr;
     wr.wr_id = wr_id;
     wr.sg_list = &sge;
     wr.num_sge = 1;
-    wr.opcode = IBV_WR_RDMA_READ;
-    if (signaled)
-        wr.send_flags |= IBV_SEND_SIGNALED;
-    wr.wr.rdma.remote_addr = src;
-    wr.wr.rdma.rkey = this->peer->match_remote_mr_rkey(src, size);
-    return ibv_post_send(this->qp, &wr, &bad_wr);
+    return ibv_post_recv(this->qp, &wr, &bad_wr);
 }
 
-int ReliableConnection::post_write(uintptr_t dst, void const *src, size_t size, bool signaled,
-                                   uint64_t wr_id)
+int ReliableConnection::post_write_imm(uintptr_t dst, void const *src, size_t size, uint32_t imm,
+                                       bool signaled, uint64_t wr_id)
 {
-    ibv_send_wr wr, *bad_wr;
+    LocalSpan local = size <= this->max_inline
+                          ? LocalSpan{const_cast<void *>(src), size, 0}
+                          : this->ctx->local_span(const_cast<void *>(src), size);
+    return this->post_write_imm(this->peer->remote_span(dst, size), local, imm, signaled, wr_id);
+}
+
+int ReliableConnection::post_write_imm(RemoteSpan const &dst, LocalSpan const &src, uint32_t imm,
+                                       bool signaled, uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(src);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(src, size);
+    sge.addr = src.uaddr();
+    sge.length = src.size;
+    sge.lkey = src.lkey;
 
     memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
     wr.wr_id = wr_id;
     wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.opcode = IBV_WR_RDMA_WRITE;
+    wr.num_sge = src.size > 0 ? 1 : 0;
+    wr.exp_opcode = IBV_EXP_WR_RDMA_WRITE_WITH_IMM;
     if (signaled)
-        wr.send_flags |= IBV_SEND_SIGNALED;
-    wr.wr.rdma.remote_addr = dst;
-    wr.wr.rdma.rkey = this->peer->match_remote_mr_rkey(dst, size);
-    return ibv_post_send(this->qp, &wr, &bad_wr);
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    if (src.size <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    wr.ex.imm_data = htonl(imm);
+    wr.wr.rdma.remote_addr = dst.addr;
+    wr.wr.rdma.rkey = dst.rkey;
+    return this->submit(&wr);
 }
 
-int ReliableConnection::post_send(void const *src, size_t size, bool signaled, uint64_t wr_id)
+int ReliableConnection::post_send_imm(void const *src, size_t size, uint32_t imm, bool signaled,
+                                      uint64_t wr_id)
+{
+    LocalSpan local = size <= this->max_inline
+                          ? LocalSpan{const_cast<void *>(src), size, 0}
+                          : this->ctx->local_span(const_cast<void *>(src), size);
+    return this->post_send_imm(local, imm, signaled, wr_id);
+}
+
+int ReliableConnection::post_send_imm(LocalSpan const &src, uint32_t imm, bool signaled,
+                                      uint64_t wr_id)
 {
-    ibv_send_wr wr, *bad_wr;
+    ibv_exp_send_wr wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(src);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(src, size);
+    sge.addr = src.uaddr();
+    sge.length = src.size;
+    sge.lkey = src.lkey;
 
     memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
     wr.wr_id = wr_id;
     wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.opcode = IBV_WR_SEND;
+    wr.num_sge = src.size > 0 ? 1 : 0;
+    wr.exp_opcode = IBV_EXP_WR_SEND_WITH_IMM;
     if (signaled)
-        wr.send_flags = IBV_SEND_SIGNALED;
-    return ibv_post_send(this->qp, &wr, &bad_wr);
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    if (src.size <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    wr.ex.imm_data = htonl(imm);
+    return this->submit(&wr);
 }
 
-int ReliableConnection::post_recv(void *dst, size_t size, uint64_t wr_id)
+int ReliableConnection::post_read(LocalSpan const *dst, int count, RemoteSpan const &src,
+                                  bool signaled, uint64_t wr_id)
 {
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
+    ibv_exp_send_wr wr;
+    ibv_sge sge[Consts::MaxSge];
+    fill_sges(sge, dst, count);
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = sge;
+    wr.num_sge = count;
+    wr.exp_opcode = IBV_EXP_WR_RDMA_READ;
+    if (signaled)
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = src.addr;
+    wr.wr.rdma.rkey = src.rkey;
+    return this->submit(&wr);
+}
+
+int ReliableConnection::post_write(RemoteSpan const &dst, LocalSpan const *src, int count,
+                                   bool signaled, uint64_t wr_id)
+{
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
+    ibv_exp_send_wr wr;
+    ibv_sge sge[Consts::MaxSge];
+    size_t total = fill_sges(sge, src, count);
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = sge;
+    wr.num_sge = count;
+    wr.exp_opcode = IBV_EXP_WR_RDMA_WRITE;
+    if (signaled)
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    if (total <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    wr.wr.rdma.remote_addr = dst.addr;
+    wr.wr.rdma.rkey = dst.rkey;
+    return this->submit(&wr);
+}
+
+int ReliableConnection::post_send(LocalSpan const *src, int count, bool signaled, uint64_t wr_id)
+{
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
+    ibv_exp_send_wr wr;
+    ibv_sge sge[Consts::MaxSge];
+    size_t total = fill_sges(sge, src, count);
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = sge;
+    wr.num_sge = count;
+    wr.exp_opcode = IBV_EXP_WR_SEND;
+    if (signaled)
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    if (total <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    return this->submit(&wr);
+}
+
+int ReliableConnection::post_recv(LocalSpan const *dst, int count, uint64_t wr_id)
+{
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
     ibv_recv_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(dst);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(dst, size);
+    ibv_sge sge[Consts::MaxSge];
+    fill_sges(sge, dst, count);
 
     memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
     wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
+    wr.sg_list = sge;
+    wr.num_sge = count;
     return ibv_post_recv(this->qp, &wr, &bad_wr);
 }
 
 int ReliableConnection::post_atomic_cas(uintptr_t dst, void *compare, uint64_t swap, bool signaled,
                                         uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
-        Emergency::abort("post atomic CAS to non-aligned address");
+    return this->post_atomic_cas(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                 this->ctx->local_span(compare, sizeof(uint64_t)), swap, signaled,
+                                 wr_id);
+}
 
-    ibv_send_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(compare);
-    sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(compare, sizeof(uint64_t));
+int ReliableConnection::post_atomic_cas(RemoteSpan const &dst, LocalSpan const &compare,
+                                        uint64_t swap, bool signaled, uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
+        Emergency::abort("post atomic CAS to non-aligned address");
 
-    memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
-    wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.opcode = IBV_WR_ATOMIC_CMP_AND_SWP;
+    uint64_t compare_val = *(reinterpret_cast<uint64_t *>(compare.addr));
     if (signaled)
-        wr.send_flags = IBV_SEND_SIGNALED;
-    wr.wr.atomic.remote_addr = dst;
-    wr.wr.atomic.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
-    wr.wr.atomic.compare_add = *(reinterpret_cast<uint64_t *>(compare));
-    wr.wr.atomic.swap = swap;
-    return ibv_post_send(this->qp, &wr, &bad_wr);
+        return this->post_atomic<IBV_EXP_WR_ATOMIC_CMP_AND_SWP>(dst, compare, compare_val, swap,
+                                                                wr_id);
+    return this->post_atomic<IBV_EXP_WR_ATOMIC_CMP_AND_SWP, 0>(dst, compare, compare_val, swap,
+                                                               wr_id);
 }
 
 int ReliableConnection::post_atomic_faa(uintptr_t dst, void *fetch, uint64_t add, bool signaled,
                                         uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
-        Emergency::abort("post atomic FA to non-aligned address");
+    return this->post_atomic_faa(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                 this->ctx->local_span(fetch, sizeof(uint64_t)), add, signaled,
+                                 wr_id);
+}
 
-    ibv_send_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(fetch);
-    sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(fetch, sizeof(uint64_t));
+int ReliableConnection::post_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch,
+                                        uint64_t add, bool signaled, uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
+        Emergency::abort("post atomic FA to non-aligned address");
 
-    memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
-    wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.opcode = IBV_WR_ATOMIC_FETCH_AND_ADD;
     if (signaled)
-        wr.send_flags = IBV_SEND_SIGNALED;
-    wr.wr.atomic.remote_addr = dst;
-    wr.wr.atomic.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
-    wr.wr.atomic.compare_add = add;
-    return ibv_post_send(this->qp, &wr, &bad_wr);
+        return this->post_atomic<IBV_EXP_WR_ATOMIC_FETCH_AND_ADD>(dst, fetch, add, 0, wr_id);
+    return this->post_atomic<IBV_EXP_WR_ATOMIC_FETCH_AND_ADD, 0>(dst, fetch, add, 0, wr_id);
 }
 
 int ReliableConnection::post_masked_atomic_cas(uintptr_t dst, void *compare, uint64_t compare_mask,
                                                uint64_t swap, uint64_t swap_mask, bool signaled,
                                                uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
+    return this->post_masked_atomic_cas(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                        this->ctx->local_span(compare, sizeof(uint64_t)),
+                                        compare_mask, swap, swap_mask, signaled, wr_id);
+}
+
+int ReliableConnection::post_masked_atomic_cas(RemoteSpan const &dst, LocalSpan const &compare,
+                                               uint64_t compare_mask, uint64_t swap,
+                                               uint64_t swap_mask, bool signaled, uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
         Emergency::abort("post masked atomic FA to non-aligned address");
 
-    ibv_exp_send_wr wr, *bad_wr;
+    ibv_exp_send_wr wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(compare);
+    sge.addr = compare.uaddr();
     sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(compare, sizeof(uint64_t));
+    sge.lkey = compare.lkey;
 
     memset(&wr, 0, sizeof(wr));
     wr.next = nullptr;
@@ -205,32 +382,56 @@ int ReliableConnection::post_masked_atomic_cas(uintptr_t dst, void *compare, uin
         wr.exp_send_flags |= IBV_EXP_SEND_SIGNALED;
 
     wr.ext_op.masked_atomics.log_arg_sz = 3;  // log(sizeof(uint64_t))
-    wr.ext_op.masked_atomics.remote_addr = dst;
-    wr.ext_op.masked_atomics.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
+    wr.ext_op.masked_atomics.remote_addr = dst.addr;
+    wr.ext_op.masked_atomics.rkey = dst.rkey;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.compare_val =
-        *(reinterpret_cast<uint64_t *>(compare));
+        *(reinterpret_cast<uint64_t *>(compare.addr));
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.compare_mask = compare_mask;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.swap_val = swap;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.swap_mask = swap_mask;
 
-    return ibv_exp_post_send(this->qp, &wr, &bad_wr);
+    return this->submit(&wr);
 }
 
 int ReliableConnection::post_field_atomic_faa(uintptr_t dst, void *fetch, uint64_t add,
                                               int highest_bit, int lowest_bit, bool signaled,
                                               uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
+    return this->post_field_atomic_faa(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                       this->ctx->local_span(fetch, sizeof(uint64_t)), add,
+                                       highest_bit, lowest_bit, signaled, wr_id);
+}
+
+int ReliableConnection::post_field_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch,
+                                              uint64_t add, int highest_bit, int lowest_bit,
+                                              bool signaled, uint64_t wr_id)
+{
+    return this->post_masked_atomic_faa(dst, fetch, add << lowest_bit, 1ull << highest_bit,
+                                        signaled, wr_id);
+}
+
+int ReliableConnection::post_masked_atomic_faa(uintptr_t dst, void *fetch, uint64_t add,
+                                               uint64_t boundary, bool signaled, uint64_t wr_id)
+{
+    return this->post_masked_atomic_faa(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                        this->ctx->local_span(fetch, sizeof(uint64_t)), add,
+                                        boundary, signaled, wr_id);
+}
+
+int ReliableConnection::post_masked_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch,
+                                               uint64_t add, uint64_t boundary, bool signaled,
+                                               uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
         Emergency::abort("post masked atomic FA to non-aligned address");
 
-    ibv_exp_send_wr wr, *bad_wr;
+    ibv_exp_send_wr wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(fetch);
+    sge.addr = fetch.uaddr();
     sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(fetch, sizeof(uint64_t));
+    sge.lkey = fetch.lkey;
 
     memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
     wr.wr_id = wr_id;
     wr.sg_list = &sge;
     wr.num_sge = 1;
@@ -240,47 +441,73 @@ int ReliableConnection::post_field_atomic_faa(uintptr_t dst, void *fetch, uint64
         wr.exp_send_flags |= IBV_EXP_SEND_SIGNALED;
 
     wr.ext_op.masked_atomics.log_arg_sz = 3;  // log(sizeof(uint64_t))
-    wr.ext_op.masked_atomics.remote_addr = dst;
-    wr.ext_op.masked_atomics.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
-    wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.add_val = add << lowest_bit;
-    wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.field_boundary = 1ull << highest_bit;
+    wr.ext_op.masked_atomics.remote_addr = dst.addr;
+    wr.ext_op.masked_atomics.rkey = dst.rkey;
+    wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.add_val = add;
+    wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.field_boundary = boundary;
 
-    return ibv_exp_post_send(this->qp, &wr, &bad_wr);
+    return this->submit(&wr);
 }
 
-int ReliableConnection::post_masked_atomic_faa(uintptr_t dst, void *fetch, uint64_t add,
-                                               uint64_t boundary, bool signaled, uint64_t wr_id)
+int ReliableConnection::post_bind_mw(ibv_mw *mw, void *addr, size_t size, RemoteSpan *granted,
+                                     int perm, bool signaled, uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
-        Emergency::abort("post masked atomic FA to non-aligned address");
+    ibv_mr *mr = this->ctx->find_mr(addr, size);
+    if (__glibc_unlikely(mr == nullptr))
+        Emergency::abort("cannot match local mr");
 
-    ibv_exp_send_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(fetch);
-    sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(fetch, sizeof(uint64_t));
+    ibv_exp_send_wr wr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.exp_opcode = IBV_EXP_WR_BIND_MW;
+    if (signaled)
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+
+    wr.bind_mw.mw = mw;
+    wr.bind_mw.rkey = ibv_inc_rkey(mw->rkey);  // Type 2 windows take a fresh rkey on each bind
+    wr.bind_mw.bind_info.mr = mr;
+    wr.bind_mw.bind_info.addr = reinterpret_cast<uintptr_t>(addr);
+    wr.bind_mw.bind_info.length = size;
+    wr.bind_mw.bind_info.exp_mw_access_flags = perm;
+
+    int rc = this->submit(&wr);
+    if (rc == 0) {
+        mw->rkey = wr.bind_mw.rkey;
+        *granted = {reinterpret_cast<uintptr_t>(addr), size, mw->rkey};
+    }
+    return rc;
+}
 
+int ReliableConnection::post_invalidate_mw(ibv_mw *mw, bool signaled, uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
     memset(&wr, 0, sizeof(wr));
     wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.exp_opcode = IBV_EXP_WR_EXT_MASKED_ATOMIC_FETCH_AND_ADD;
-    wr.exp_send_flags = IBV_EXP_SEND_EXT_ATOMIC_INLINE;
+    wr.exp_opcode = IBV_EXP_WR_LOCAL_INV;
     if (signaled)
-        wr.exp_send_flags |= IBV_EXP_SEND_SIGNALED;
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    wr.ex.invalidate_rkey = mw->rkey;
 
-    wr.ext_op.masked_atomics.log_arg_sz = 3;  // log(sizeof(uint64_t))
-    wr.ext_op.masked_atomics.remote_addr = dst;
-    wr.ext_op.masked_atomics.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
-    wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.add_val = add;
-    wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.field_boundary = boundary;
+    return this->submit(&wr);
+}
 
-    return ibv_exp_post_send(this->qp, &wr, &bad_wr);
+PreparedOp ReliableConnection::prepare(ibv_exp_wr_opcode opcode, bool signaled)
+{
+    switch (opcode) {
+    case IBV_EXP_WR_RDMA_READ:
+    case IBV_EXP_WR_RDMA_WRITE:
+    case IBV_EXP_WR_SEND:
+    case IBV_EXP_WR_ATOMIC_CMP_AND_SWP:
+    case IBV_EXP_WR_ATOMIC_FETCH_AND_ADD:
+        return PreparedOp(this->qp, opcode, signaled);
+    default:
+        Emergency::abort("cannot prepare opcode " + std::to_string(opcode));
+    }
 }
 
 int ReliableConnection::post_wait(ibv_cq *cq, int cqe, bool signaled)
 {
-    ibv_exp_send_wr wr, *bad_wr;
+    ibv_exp_send_wr wr;
 
     memset(&wr, 0, sizeof(wr));
     wr.exp_opcode = IBV_EXP_WR_CQE_WAIT;
@@ -291,7 +518,7 @@ int ReliableConnection::post_wait(ibv_cq *cq, int cqe, bool signaled)
     wr.task.cqe_wait.cq = cq;
     wr.task.cqe_wait.cq_count = cqe;
 
-    return ibv_exp_post_send(this->qp, &wr, &bad_wr);
+    return this->submit(&wr);
 }
 
 int ReliableConnection::post_batch_read(void **dst_arr, uintptr_t *src_arr, size_t *size_arr,
@@ -300,7 +527,7 @@ int ReliableConnection::post_batch_read(void **dst_arr, uintptr_t *src_arr, size
     if (count <= 0 || count > Consts::MaxPostWR)
         return -1;
 
-    ibv_send_wr wr[Consts::MaxPostWR], *bad_wr;
+    ibv_exp_send_wr wr[Consts::MaxPostWR];
     ibv_sge sge[Consts::MaxPostWR];
     for (int i = 0; i < count; ++i) {
         sge[i].addr = reinterpret_cast<uintptr_t>(dst_arr[i]);
@@ -308,19 +535,19 @@ int ReliableConnection::post_batch_read(void **dst_arr, uintptr_t *src_arr, size
         sge[i].lkey = this->ctx->match_mr_lkey(dst_arr[i], size_arr[i]);
     }
 
-    memset(wr, 0, sizeof(ibv_send_wr) * count);
+    memset(wr, 0, sizeof(ibv_exp_send_wr) * count);
     for (int i = 0; i < count; ++i) {
         wr[i].next = (i == count - 1 ? nullptr : wr + (i + 1));
         wr[i].wr_id = wr_id_start + i;
         wr[i].sg_list = sge + i;
         wr[i].num_sge = 1;
-        wr[i].opcode = IBV_WR_RDMA_READ;
+        wr[i].exp_opcode = IBV_EXP_WR_RDMA_READ;
         if (i == count - 1 && signaled)
-            wr[i].send_flags = IBV_SEND_SIGNALED;
+            wr[i].exp_send_flags = IBV_EXP_SEND_SIGNALED;
         wr[i].wr.rdma.remote_addr = src_arr[i];
         wr[i].wr.rdma.rkey = this->peer->match_remote_mr_rkey(src_arr[i], size_arr[i]);
     }
-    return ibv_post_send(this->qp, wr, &bad_wr);
+    return this->post_send(wr);
 }
 
 int ReliableConnection::post_batch_write(uintptr_t *dst_arr, void **src_arr, size_t *size_arr,
@@ -329,7 +556,7 @@ int ReliableConnection::post_batch_write(uintptr_t *dst_arr, void **src_arr, siz
     if (count <= 0 || count > Consts::MaxPostWR)
         return -1;
 
-    ibv_send_wr wr[Consts::MaxPostWR], *bad_wr;
+    ibv_exp_send_wr wr[Consts::MaxPostWR];
     ibv_sge sge[Consts::MaxPostWR];
     for (int i = 0; i < count; ++i) {
         sge[i].addr = reinterpret_cast<uintptr_t>(src_arr[i]);
@@ -337,19 +564,19 @@ int ReliableConnection::post_batch_write(uintptr_t *dst_arr, void **src_arr, siz
         sge[i].lkey = this->ctx->match_mr_lkey(src_arr[i], size_arr[i]);
     }
 
-    memset(wr, 0, sizeof(ibv_send_wr) * count);
+    memset(wr, 0, sizeof(ibv_exp_send_wr) * count);
     for (int i = 0; i < count; ++i) {
         wr[i].next = (i == count - 1 ? nullptr : wr + (i + 1));
         wr[i].wr_id = wr_id_start + i;
         wr[i].sg_list = sge + i;
         wr[i].num_sge = 1;
-        wr[i].opcode = IBV_WR_RDMA_WRITE;
+        wr[i].exp_opcode = IBV_EXP_WR_RDMA_WRITE;
         if (i == count - 1)
-            wr[i].send_flags = IBV_SEND_SIGNALED;
+            wr[i].exp_send_flags = IBV_EXP_SEND_SIGNALED;
         wr[i].wr.rdma.remote_addr = dst_arr[i];
         wr[i].wr.rdma.rkey = this->peer->match_remote_mr_rkey(dst_arr[i], size_arr[i]);
     }
-    return ibv_post_send(this->qp, wr, &bad_wr);
+    return this->post_send(wr);
 }
 
 int ReliableConnection::post_batch_masked_atomic_faa(uintptr_t *dst_arr, void **fetch_arr,
@@ -359,7 +586,7 @@ int ReliableConnection::post_batch_masked_atomic_faa(uintptr_t *dst_arr, void **
     if (count <= 0 || count > Consts::MaxPostWR)
         return -1;
 
-    ibv_exp_send_wr wr[Consts::MaxPostWR], *bad_wr;
+    ibv_exp_send_wr wr[Consts::MaxPostWR];
     ibv_sge sge[Consts::MaxPostWR];
     for (int i = 0; i < count; ++i) {
         if (__glibc_unlikely((reinterpret_cast<uintptr_t>(fetch_arr[i]) & 0x7) != 0))
@@ -392,7 +619,174 @@ int ReliableConnection::post_batch_masked_atomic_faa(uintptr_t *dst_arr, void **
         wr[i].ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.field_boundary =
             boundary_arr[i];
     }
-    return ibv_exp_post_send(this->qp, wr, &bad_wr);
+    return this->post_send(wr);
+}
+
+int ReliableConnection::post_chain(WrChain &chain)
+{
+    ibv_exp_send_wr *head = chain.link();
+    if (head == nullptr)
+        return -1;
+
+    return this->post_send(head);
+}
+
+int ReliableConnection::set_deferred(bool enable, int threshold)
+{
+    int rc = this->flush_pending();
+    if (rc != 0)
+        return rc;
+    if (enable)
+        this->deferred.enable(threshold);
+    else
+        this->deferred.disable();
+    return 0;
+}
+
+int ReliableConnection::flush()
+{
+    int rc = 0;
+    if (this->deferred.size() > 0) {
+        ibv_exp_send_wr *bad_wr;
+        rc = ibv_exp_post_send(this->qp, this->deferred.head(), &bad_wr);
+        if (__glibc_likely(rc == 0))
+            this->deferred.clear();
+        else
+            this->deferred.retain_from(bad_wr);  // Retried by the next flush
+    }
+    this->flush_error = rc;
+    return rc;
+}
+
+int ReliableConnection::set_managed(bool enable, int signal_every, bool blocking)
+{
+    if (enable && !this->cq_self)
+        Emergency::abort("managed mode requires a send CQ of its own");
+
+    int rc = this->flush_pending();
+    if (rc != 0)
+        return rc;
+    if (enable)
+        this->credits.enable(Consts::MaxQueueDepth, signal_every, blocking);
+    else
+        this->credits.disable();
+    return 0;
+}
+
+int ReliableConnection::admit(ibv_exp_send_wr *wr)
+{
+    int n = 0;
+    for (ibv_exp_send_wr *p = wr; p; p = p->next)
+        ++n;
+    if (n > this->credits.max_admit())
+        return EINVAL;
+
+    while (!this->credits.available(n)) {
+        // WRs covering the outstanding ones may still be pending
+        this->flush_pending();
+        if (this->credits.reclaim(this->send_cq) == 0 && !this->credits.blocking())
+            return EAGAIN;
+    }
+    this->credits.track(wr);
+    return 0;
+}
+
+int ReliableConnection::post_batch_atomic_cas(uintptr_t *dst_arr, void **compare_arr,
+                                              uint64_t *swap_arr, int count, uint64_t wr_id_start,
+                                              bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    RemoteSpan dst[Consts::MaxPostWR];
+    LocalSpan compare[Consts::MaxPostWR];
+    for (int i = 0; i < count; ++i) {
+        dst[i] = this->peer->remote_span(dst_arr[i], sizeof(uint64_t));
+        compare[i] = this->ctx->local_span(compare_arr[i], sizeof(uint64_t));
+    }
+    return this->post_batch_atomic_cas(dst, compare, swap_arr, count, wr_id_start, signaled);
+}
+
+int ReliableConnection::post_batch_atomic_cas(RemoteSpan const *dst_arr,
+                                              LocalSpan const *compare_arr,
+                                              uint64_t const *swap_arr, int count,
+                                              uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    WrChain chain;
+    for (int i = 0; i < count; ++i)
+        chain.cas(dst_arr[i], compare_arr[i], swap_arr[i],
+                  (i == count - 1 && signaled) ? IBV_EXP_SEND_SIGNALED : 0, wr_id_start + i);
+    return this->post_chain(chain);
+}
+
+int ReliableConnection::post_batch_atomic_faa(uintptr_t *dst_arr, void **fetch_arr,
+                                              uint64_t *add_arr, int count, uint64_t wr_id_start,
+                                              bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    RemoteSpan dst[Consts::MaxPostWR];
+    LocalSpan fetch[Consts::MaxPostWR];
+    for (int i = 0; i < count; ++i) {
+        dst[i] = this->peer->remote_span(dst_arr[i], sizeof(uint64_t));
+        fetch[i] = this->ctx->local_span(fetch_arr[i], sizeof(uint64_t));
+    }
+    return this->post_batch_atomic_faa(dst, fetch, add_arr, count, wr_id_start, signaled);
+}
+
+int ReliableConnection::post_batch_atomic_faa(RemoteSpan const *dst_arr, LocalSpan const *fetch_arr,
+                                              uint64_t const *add_arr, int count,
+                                              uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    WrChain chain;
+    for (int i = 0; i < count; ++i)
+        chain.faa(dst_arr[i], fetch_arr[i], add_arr[i],
+                  (i == count - 1 && signaled) ? IBV_EXP_SEND_SIGNALED : 0, wr_id_start + i);
+    return this->post_chain(chain);
+}
+
+int ReliableConnection::post_batch_masked_atomic_cas(uintptr_t *dst_arr, void **compare_arr,
+                                                     uint64_t *compare_mask_arr, uint64_t *swap_arr,
+                                                     uint64_t *swap_mask_arr, int count,
+                                                     uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    RemoteSpan dst[Consts::MaxPostWR];
+    LocalSpan compare[Consts::MaxPostWR];
+    for (int i = 0; i < count; ++i) {
+        dst[i] = this->peer->remote_span(dst_arr[i], sizeof(uint64_t));
+        compare[i] = this->ctx->local_span(compare_arr[i], sizeof(uint64_t));
+    }
+    return this->post_batch_masked_atomic_cas(dst, compare, compare_mask_arr, swap_arr,
+                                              swap_mask_arr, count, wr_id_start, signaled);
+}
+
+int ReliableConnection::post_batch_masked_atomic_cas(RemoteSpan const *dst_arr,
+                                                     LocalSpan const *compare_arr,
+                                                     uint64_t const *compare_mask_arr,
+                                                     uint64_t const *swap_arr,
+                                                     uint64_t const *swap_mask_arr, int count,
+                                                     uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    WrChain chain;
+    for (int i = 0; i < count; ++i)
+        chain.masked_cas(dst_arr[i], compare_arr[i], compare_mask_arr[i], swap_arr[i],
+                         swap_mask_arr[i],
+                         (i == count - 1 && signaled) ? IBV_EXP_SEND_SIGNALED : 0,
+                         wr_id_start + i);
+    return this->post_chain(chain);
 }
 
 void ReliableConnection::fill_sge(ibv_sge *sge, void *addr, size_t length)
@@ -404,6 +798,15 @@ void ReliableConnection::fill_sge(ibv_sge *sge, void *addr, size_t length)
 
 int ReliableConnection::post_send(ibv_exp_send_wr *wr)
 {
+    // Posting ahead of WRs that failed to flush would reorder them
+    int rc = this->flush_pending();
+    if (rc != 0)
+        return rc;
+    if (__glibc_unlikely(this->credits.enabled())) {
+        rc = this->admit(wr);
+        if (rc != 0)
+            return rc;
+    }
     ibv_exp_send_wr *bad_wr;
     return ibv_exp_post_send(this->qp, wr, &bad_wr);
 }
@@ -416,6 +819,7 @@ int ReliableConnection::post_recv(ibv_recv_wr *wr)
 
 int ReliableConnection::poll_send_cq(int n)
 {
+    this->flush_pending();
     ibv_wc wc_arr[32];
 
     for (int i = 0; i < n; i += 32) {
@@ -423,38 +827,31 @@ int ReliableConnection::poll_send_cq(int n)
         if (m > 32)
             m = 32;
         while (m > res) {
-            res += ibv_poll_cq(this->send_cq, m - res, wc_arr + res);
+            res += this->poll_send_raw(m - res, wc_arr + res);
         }
-        // for (int j = 0; j < m; ++j)
-        //     if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-        //         Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
     }
     return n;
 }
 
 int ReliableConnection::poll_send_cq(ibv_wc *wc_arr, int n)
 {
+    this->flush_pending();
     int res = 0;
     while (n > res) {
-        res += ibv_poll_cq(this->send_cq, n - res, wc_arr + res);
+        res += this->poll_send_raw(n - res, wc_arr + res);
     }
-    // for (int j = 0; j < n; ++j)
-    //     if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-    //         Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
     return res;
 }
 
 int ReliableConnection::poll_send_cq_once(ibv_wc *wc_arr, int n)
 {
-    int res = ibv_poll_cq(this->send_cq, n, wc_arr);
-    // for (int j = 0; j < res; ++j)
-    //     if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-    //         Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
-    return res;
+    this->flush_pending();
+    return this->poll_send_raw(n, wc_arr);
 }
 
 int ReliableConnection::poll_recv_cq(int n)
 {
+    this->flush_pending();
     ibv_wc wc_arr[32];
 
     for (int i = 0; i < n; i += 32) {
@@ -462,32 +859,75 @@ int ReliableConnection::poll_recv_cq(int n)
         if (m > 32)
             m = 32;
         while (m > res) {
-            res += ibv_poll_cq(this->recv_cq, m - res, wc_arr + res);
+            res += this->poll_recv_raw(m - res, wc_arr + res);
         }
-        for (int j = 0; j < m; ++j)
-            if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-                Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
     }
     return n;
 }
 
 int ReliableConnection::poll_recv_cq(ibv_wc *wc_arr, int n)
 {
+    this->flush_pending();
     int res = 0;
     while (n > res)
-        res += ibv_poll_cq(this->recv_cq, n - res, wc_arr + res);
-    for (int j = 0; j < n; ++j)
-        if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-            Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
+        res += this->poll_recv_raw(n - res, wc_arr + res);
     return res;
 }
 
 int ReliableConnection::poll_recv_cq_once(ibv_wc *wc_arr, int n)
 {
-    int res = ibv_poll_cq(this->recv_cq, n, wc_arr);
+    this->flush_pending();
+    return this->poll_recv_raw(n, wc_arr);
+}
+
+int ReliableConnection::poll_send_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n)
+{
+    if (this->credits.enabled())
+        Emergency::abort("completion timestamps are not available in managed mode");
+    this->flush_pending();
+    int res = poll_cq_timestamped(this->send_cq, this->ctx->clock, wc_arr, ts_arr, n);
+    if (res > 0)
+        this->check(wc_arr, res, true);
+    return res;
+}
+
+int ReliableConnection::poll_recv_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n)
+{
+    this->flush_pending();
+    int res = poll_cq_timestamped(this->recv_cq, this->ctx->clock, wc_arr, ts_arr, n);
+    if (res > 0)
+        this->check(wc_arr, res, false);
+    return res;
+}
+
+int ReliableConnection::wait_send_cq(ibv_wc *wc_arr, int n, int spin_us, int timeout_ms)
+{
+    this->flush_pending();
+    auto poll_once = [this](ibv_wc *wc_arr, int n) { return this->poll_send_raw(n, wc_arr); };
+    return this->send_channel.wait(this->send_cq, poll_once, wc_arr, n, spin_us, timeout_ms);
+}
+
+int ReliableConnection::wait_recv_cq(ibv_wc *wc_arr, int n, int spin_us, int timeout_ms)
+{
+    this->flush_pending();
+    auto poll_once = [this](ibv_wc *wc_arr, int n) { return this->poll_recv_raw(n, wc_arr); };
+    return this->recv_channel.wait(this->recv_cq, poll_once, wc_arr, n, spin_us, timeout_ms);
+}
+
+int ReliableConnection::poll_recv_cq(RecvCompletion *rc_arr, int n)
+{
+    int res = 0;
+    while (n > res)
+        res += this->poll_recv_cq_once(rc_arr + res, n - res);
+    return res;
+}
+
+int ReliableConnection::poll_recv_cq_once(RecvCompletion *rc_arr, int n)
+{
+    ibv_wc wc_arr[32];
+    int res = this->poll_recv_cq_once(wc_arr, std::min(n, 32));
     for (int j = 0; j < res; ++j)
-        if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-            Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
+        rc_arr[j] = RecvCompletion::from(wc_arr[j]);
     return res;
 }
 
@@ -514,9 +954,15 @@ int ReliableConnection::verbose() const
     return 0;
 }
 
-int ReliableConnection::create_cq(ibv_cq **cq, int cq_depth)
+int ReliableConnection::create_cq(ibv_cq **cq, ibv_comp_channel *channel, int cq_depth)
 {
-    *cq = ibv_create_cq(this->ctx->ctx, cq_depth, nullptr, nullptr, 0);
+    ibv_exp_cq_init_attr attr;
+    memset(&attr, 0, sizeof(ibv_exp_cq_init_attr));
+    if (this->cluster->cq_timestamps) {
+        attr.comp_mask = IBV_EXP_CQ_INIT_ATTR_FLAGS;
+        attr.flags = IBV_EXP_CQ_TIMESTAMP;
+    }
+    *cq = ibv_exp_create_cq(this->ctx->ctx, cq_depth, nullptr, channel, 0, &attr);
     return errno;
 }
 
@@ -535,13 +981,14 @@ int ReliableConnection::create_qp(int qp_depth)
     init_attr.max_atomic_arg = sizeof(uint64_t);  // Enable extended atomics
     init_attr.cap.max_send_wr = qp_depth;
     init_attr.cap.max_recv_wr = qp_depth;
-    init_attr.cap.max_inline_data = 0;
-    init_attr.cap.max_send_sge = 16;
-    init_attr.cap.max_recv_sge = 16;
+    init_attr.cap.max_inline_data = this->cluster->max_inline;
+    init_attr.cap.max_send_sge = Consts::MaxSge;
+    init_attr.cap.max_recv_sge = Consts::MaxSge;
 
     this->qp = ibv_exp_create_qp(this->ctx->ctx, &init_attr);
     if (!this->qp)
         Emergency::abort("cannot create QP: " + std::to_string(errno));
+    this->max_inline = std::min<uint32_t>(init_attr.cap.max_inline_data, Consts::MaxInlineData);
     return errno;
 }
 
@@ -550,20 +997,62 @@ void ReliableConnection::fill_exchange(OOBExchange *xchg)
     xchg->rc_qp_num[this->id] = this->qp->qp_num;
 }
 
+void ReliableConnection::recover()
+{
+    this->deferred.clear();
+    this->flush_error = 0;
+    this->credits.reset();
+
+    this->modify_to_reset();
+    this->modify_to_init();
+    this->modify_to_rtr(this->remote_gid, this->remote_lid, this->remote_qpn);
+    this->modify_to_rts();
+    this->in_error = false;
+}
+
+void ReliableConnection::report(ibv_wc const &wc, bool send)
+{
+    CompletionError err = CompletionError::from(wc, this->peer->id, this->id, "rc", send);
+    bool first = !this->in_error;
+    if (first) {
+        this->in_error = true;
+        this->first_error = err;
+    }
+
+    if (this->on_error)
+        this->on_error(err);
+    else if (first || wc.status != IBV_WC_WR_FLUSH_ERR)
+        err.print(this->cluster->whoami());
+}
+
 void ReliableConnection::establish(ibv_gid gid, int lid, uint32_t qpn)
 {
+    this->remote_gid = gid;
+    this->remote_lid = lid;
+    this->remote_qpn = qpn;
+
     this->modify_to_init();
     this->modify_to_rtr(gid, lid, qpn);
     this->modify_to_rts();
 }
 
+void ReliableConnection::modify_to_reset()
+{
+    ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.qp_state = IBV_QPS_RESET;
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE))
+        Emergency::abort("failed to modify QP to reset");
+}
+
 void ReliableConnection::modify_to_init()
 {
     ibv_qp_attr attr;
     memset(&attr, 0, sizeof(attr));
 
     attr.qp_state = IBV_QPS_INIT;
-    attr.port_num = 1;
+    attr.port_num = this->ctx->port;
     attr.pkey_index = 0;
     attr.qp_access_flags =
         IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
@@ -586,12 +1075,12 @@ void ReliableConnection::modify_to_rtr(ibv_gid gid, int lid, uint32_t qpn)
     attr.ah_attr.dlid = lid;
     attr.ah_attr.sl = 0;
     attr.ah_attr.src_path_bits = 0;
-    attr.ah_attr.port_num = 1;
+    attr.ah_attr.port_num = this->ctx->port;
     attr.ah_attr.is_global = 1;
     memcpy(&attr.ah_attr.grh.dgid, &gid, sizeof(ibv_gid));
     attr.ah_attr.grh.flow_label = 0;
     attr.ah_attr.grh.hop_limit = 1;
-    attr.ah_attr.grh.sgid_index = 1;
+    attr.ah_attr.grh.sgid_index = this->ctx->gid_index;
     attr.ah_attr.grh.traffic_class = 0;
     attr.max_dest_rd_atomic = 16;
     attr.min_rnr_timer = 12;
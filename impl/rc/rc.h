@@ -2,8 +2,16 @@
 #define __RC_H__
 
 #include "../cluster.h"
+#include "../chain.h"
+#include "../channel.h"
+#include "../completion.h"
 #include "../context.h"
+#include "../credits.h"
+#include "../deferred.h"
 #include "../peer.h"
+#include "../post.h"
+#include "../prepared.h"
+#include "../shared_cq.h"
 
 namespace rdma {
 
@@ -13,6 +21,7 @@ namespace rdma {
 class ReliableConnection {
     friend class Peer;
     friend class Cluster;
+    friend class SharedCq;
 
   public:
     ReliableConnection(ReliableConnection const &) = delete;
@@ -174,6 +183,332 @@ class ReliableConnection {
     int post_masked_atomic_faa(uintptr_t dst, void *fetch, uint64_t add, uint64_t boundary,
                                bool signaled = false, uint64_t wr_id = 0);
 
+    /**
+     * @brief Post RDMA one-sided READ verb to this QP, with pre-resolved keys.
+     * Reads `dst.size` bytes; no MR lookup is performed.
+     *
+     * @param dst Local span, the destination to place the read content.
+     * @param src Remote span, the source to read.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function.
+     */
+    int post_read(LocalSpan const &dst, RemoteSpan const &src, bool signaled = false,
+                  uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided WRITE verb to this QP, with pre-resolved keys.
+     * Writes `src.size` bytes; no MR lookup is performed.
+     *
+     * @param dst Remote span, the destination to place the written content.
+     * @param src Local span, the source of write content.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function.
+     */
+    int post_write(RemoteSpan const &dst, LocalSpan const &src, bool signaled = false,
+                   uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA two-sided SEND verb to this QP, with pre-resolved keys.
+     *
+     * @param src Local span, the source of send content.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function.
+     */
+    int post_send(LocalSpan const &src, bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA two-sided RECV verb to this QP, with pre-resolved keys.
+     *
+     * @param dst Local span, the destination to place received content.
+     * @param wr_id The work request ID associated with this request.
+     * @return int The status code returned by `ibv_post_recv` function.
+     */
+    int post_recv(LocalSpan const &dst, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided WRITE verb with immediate data to this QP.
+     * Besides writing, it consumes a RECV posted by the peer, whose completion carries `imm` (see
+     * `RecvCompletion`), so one WR both places data and notifies the peer.
+     *
+     * @param dst Remote virtual address, the destination to place the written content. Must have
+     * been registered by the peer.
+     * @param src Local virtual address, the source of write content. Must have been registered
+     * locally, unless the write is inlined.
+     * @param size Bytes to write (may be 0 for a pure notification).
+     * @param imm The 32-bit immediate data.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function.
+     */
+    int post_write_imm(uintptr_t dst, void const *src, size_t size, uint32_t imm,
+                       bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided WRITE verb with immediate data, with pre-resolved keys.
+     * See `post_write_imm` above.
+     */
+    int post_write_imm(RemoteSpan const &dst, LocalSpan const &src, uint32_t imm,
+                       bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA two-sided SEND verb with immediate data to this QP.
+     *
+     * @param src Local virtual address, the source of send content. Must have been registered
+     * locally, unless the send is inlined.
+     * @param size Bytes to send.
+     * @param imm The 32-bit immediate data, delivered in the peer's RECV completion.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function.
+     */
+    int post_send_imm(void const *src, size_t size, uint32_t imm, bool signaled = false,
+                      uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA two-sided SEND verb with immediate data, with pre-resolved keys.
+     * See `post_send_imm` above.
+     */
+    int post_send_imm(LocalSpan const &src, uint32_t imm, bool signaled = false,
+                      uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided READ verb scattering into several local segments.
+     * Reads the total size of the segments from the start of `src`.
+     *
+     * @param dst Local spans, the destinations filled in order.
+     * @param count Number of local spans (at most `Consts::MaxSge`).
+     * @param src Remote span, the source to read.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function, EINVAL if `count` is out
+     * of range.
+     */
+    int post_read(LocalSpan const *dst, int count, RemoteSpan const &src, bool signaled = false,
+                  uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided WRITE verb gathering several local segments.
+     * Writes the segments back-to-back from the start of `dst`, e.g., a header and a payload from
+     * different buffers, without a staging copy.
+     *
+     * @param dst Remote span, the destination to place the written content.
+     * @param src Local spans, the sources gathered in order.
+     * @param count Number of local spans (at most `Consts::MaxSge`).
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function, EINVAL if `count` is out
+     * of range.
+     */
+    int post_write(RemoteSpan const &dst, LocalSpan const *src, int count, bool signaled = false,
+                   uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA two-sided SEND verb gathering several local segments.
+     *
+     * @param src Local spans, the sources gathered in order.
+     * @param count Number of local spans (at most `Consts::MaxSge`).
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function, EINVAL if `count` is out
+     * of range.
+     */
+    int post_send(LocalSpan const *src, int count, bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA two-sided RECV verb scattering into several local segments.
+     *
+     * @param dst Local spans, the destinations filled in order.
+     * @param count Number of local spans (at most `Consts::MaxSge`).
+     * @param wr_id The work request ID associated with this request.
+     * @return int The status code returned by `ibv_post_recv` function, EINVAL if `count` is out
+     * of range.
+     */
+    int post_recv(LocalSpan const *dst, int count, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided ATOMIC COMPARE-AND-SWAP (CAS) verb to this QP, with pre-resolved
+     * keys. Only the first 8 bytes of both spans are used.
+     *
+     * @param dst Remote span of the 8-byte to CAS.
+     * @param compare Local span of the 8-byte to compare and to place the original value.
+     * @param swap The 8-byte to swap if "compare" succeeds.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function.
+     */
+    int post_atomic_cas(RemoteSpan const &dst, LocalSpan const &compare, uint64_t swap,
+                        bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA one-sided ATOMIC FETCH-AND-ADD (FAA) verb to this QP, with pre-resolved
+     * keys. Only the first 8 bytes of both spans are used.
+     *
+     * @param dst Remote span of the 8-byte to FAA.
+     * @param fetch Local span of the destination of the fetched 8-byte.
+     * @param add The value to add.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_post_send` function.
+     */
+    int post_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch, uint64_t add,
+                        bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA experimental one-sided MASKED-CAS verb to this QP, with pre-resolved keys.
+     * See the raw-address overload for the semantics.
+     *
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_masked_atomic_cas(RemoteSpan const &dst, LocalSpan const &compare,
+                               uint64_t compare_mask, uint64_t swap, uint64_t swap_mask,
+                               bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA experimental one-sided MASKED-FAA verb to this QP, with pre-resolved keys.
+     * See the raw-address overload for the semantics.
+     *
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_field_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch, uint64_t add,
+                              int highest_bit = 63, int lowest_bit = 0, bool signaled = false,
+                              uint64_t wr_id = 0);
+
+    /**
+     * @brief Post RDMA experimental one-sided MASKED-FAA verb to this QP, with pre-resolved keys.
+     * See the raw-address overload for the semantics.
+     *
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_masked_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch, uint64_t add,
+                               uint64_t boundary, bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post a BIND verb granting the peer access to a sub-range of a local memory region
+     * through a type 2 memory window. The window is bound to this QP, so the granted rkey is only
+     * valid for accesses arriving on this connection. Hand the granted span to the peer (e.g. with
+     * a SEND), which can use it directly with the `RemoteSpan` post overloads.
+     *
+     * @param mw Memory window obtained from `Context::alloc_mw`. Rebinding a bound window
+     * revokes the previous grant.
+     * @param addr Start address of the range. Its MR must be registered with
+     * `IBV_ACCESS_MW_BIND`.
+     * @param size Length in bytes of the range.
+     * @param granted Output, the remote span (with the new rkey) to hand to the peer.
+     * @param perm Remote access permission (defaulted to remote read, write and atomics).
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_bind_mw(ibv_mw *mw, void *addr, size_t size, RemoteSpan *granted,
+                     int perm = IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE |
+                                IBV_ACCESS_REMOTE_ATOMIC,
+                     bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Post a LOCAL INVALIDATE verb revoking the current grant of a memory window.
+     * Peer accesses with the revoked rkey fail afterwards.
+     *
+     * @param mw Memory window bound with `post_bind_mw`.
+     * @param signaled If true, this request will generate a completion event in the CQ which must
+     * be later polled.
+     * @param wr_id The work request ID associated with this request. Will appear in the CQE polled
+     * if `signaled` is true.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_invalidate_mw(ibv_mw *mw, bool signaled = false, uint64_t wr_id = 0);
+
+    /**
+     * @brief Prepare a work request template on this QP, to be issued repeatedly.
+     * Dies if the opcode is not one of RDMA READ/WRITE, SEND, atomic CAS and atomic FAA.
+     *
+     * @param opcode Opcode of the work request.
+     * @param signaled If true, every post generates a completion event in the CQ which must be
+     * later polled.
+     * @return PreparedOp The work request template.
+     */
+    PreparedOp prepare(ibv_exp_wr_opcode opcode, bool signaled = false);
+
+    /**
+     * @brief Post a one-sided READ/WRITE specialized at compile time, inlined into the caller.
+     * Unlike `post_read`/`post_write`, nothing is decided at runtime: the opcode and send flags
+     * (see `StaticWr`) are template arguments, and inline is used only if `Flags` requests it.
+     *
+     * @param remote The remote buffer (source of READ, destination of WRITE).
+     * @param local The local buffer (destination of READ, source of WRITE). Its size is posted.
+     * @param wr_id The work request ID.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    template <ibv_exp_wr_opcode Opcode, unsigned Flags = IBV_EXP_SEND_SIGNALED>
+    inline int post(RemoteSpan const &remote, LocalSpan const &local, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr wr;
+        ibv_sge sge;
+        StaticWr<Opcode, Flags>::fill(&wr, &sge, remote, local, wr_id);
+        return this->submit(&wr);
+    }
+
+    /**
+     * @brief Post a SEND specialized at compile time, inlined into the caller.
+     *
+     * @param local The local buffer to send.
+     * @param wr_id The work request ID.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    template <ibv_exp_wr_opcode Opcode, unsigned Flags = IBV_EXP_SEND_SIGNALED>
+    inline int post(LocalSpan const &local, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr wr;
+        ibv_sge sge;
+        StaticWr<Opcode, Flags>::fill(&wr, &sge, local, wr_id);
+        return this->submit(&wr);
+    }
+
+    /**
+     * @brief Post an atomic CAS/FAA specialized at compile time, inlined into the caller.
+     * The remote address must be 8-byte aligned; unlike `post_atomic_cas`, it is not checked.
+     *
+     * @param remote The remote 8-byte target.
+     * @param local The local 8-byte buffer receiving the original remote value.
+     * @param compare_add The compare value (CAS) or the addend (FAA).
+     * @param swap The swap value (CAS only).
+     * @param wr_id The work request ID.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    template <ibv_exp_wr_opcode Opcode, unsigned Flags = IBV_EXP_SEND_SIGNALED>
+    inline int post_atomic(RemoteSpan const &remote, LocalSpan const &local, uint64_t compare_add,
+                           uint64_t swap = 0, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr wr;
+        ibv_sge sge;
+        StaticWr<Opcode, Flags>::fill_atomic(&wr, &sge, remote, local, compare_add, swap, wr_id);
+        return this->submit(&wr);
+    }
+
     /**
      * @brief Post RDMA experimental WAIT verb to this QP.
      *
@@ -187,7 +522,8 @@ class ReliableConnection {
 
     /**
      * @brief Post a batch of RDMA one-sided READ verbs to this QP.
-     * User is responsible to ensure that QP send queue will not overflow.
+     * User is responsible to ensure that QP send queue will not overflow, unless in managed mode
+     * (see `set_managed`).
      * Only the last READ will generate a CQE.
      *
      * @param dst_arr An array of local destination addresses.
@@ -205,7 +541,8 @@ class ReliableConnection {
 
     /**
      * @brief Post a batch of RDMA one-sided WRITE verbs to this QP.
-     * User is responsible to ensure that QP send queue will not overflow.
+     * User is responsible to ensure that QP send queue will not overflow, unless in managed mode
+     * (see `set_managed`).
      * Only the last WRITE will generate a CQE.
      *
      * @param dst_arr An array of remote destination addresses.
@@ -240,6 +577,167 @@ class ReliableConnection {
                                      uint64_t *boundary_arr, int count, uint64_t wr_id_start = 0,
                                      bool signaled = true);
 
+    /**
+     * @brief Post a chain of heterogeneous WRs with one `ibv_exp_post_send` call.
+     * Pending WRs of deferred mode are flushed first.
+     *
+     * @param chain The chain to post. It can be cleared and reused right after.
+     * @return int The status code returned by `ibv_exp_post_send` function, -1 if the chain is
+     * empty or overflowed.
+     */
+    int post_chain(WrChain &chain);
+
+    /**
+     * @brief Enable or disable deferred doorbell mode.
+     * In deferred mode, single-op posts append their WRs to a pending chain instead of posting
+     * them. The chain is posted with one `ibv_exp_post_send` call (one doorbell) on `flush`, when
+     * it reaches `threshold` WRs, before polling any CQ, and before any batch or raw post (so
+     * that WRs keep their order). Posts return 0 unless they trigger a flush that fails.
+     * `PreparedOp` posts go straight to the QP; flush before issuing them if order matters.
+     * Disabling the mode flushes the pending chain.
+     *
+     * A failed flush never loses WRs (see `flush`). A batch or raw post behind WRs that fail to
+     * flush returns the error without posting, so that order is kept. A poll goes ahead anyway
+     * (e.g., on ENOMEM while the send queue is full, polling is what drains it for the next
+     * flush), and the error is left in `flush_status`.
+     *
+     * @param enable If true, enable deferred mode.
+     * @param threshold Number of pending WRs that triggers a flush (at most
+     * `Consts::MaxQueueDepth`).
+     * @return int 0 on success, or the status code of the failed flush of pending WRs, in which
+     * case the mode is unchanged.
+     */
+    int set_deferred(bool enable, int threshold = Consts::MaxPostWR);
+
+    /**
+     * @brief Post all pending WRs of deferred mode.
+     * If `ibv_exp_post_send` fails partway, the WRs posted ahead of the failed one are dropped
+     * from the chain, and the failed one and those after it stay pending (with their managed mode
+     * credits) for the next flush to retry. The same holds when a post triggers a flush that
+     * fails: its WR stays pending even though the post returns the error.
+     *
+     * @return int The status code returned by `ibv_exp_post_send` function (0 if none pending).
+     */
+    int flush();
+
+    /**
+     * @brief Get the status of the last flush of deferred mode, including the implicit ones.
+     * @return int 0 if it left no WR pending, else the status code returned by
+     * `ibv_exp_post_send` function.
+     */
+    inline int flush_status() const { return this->flush_error; }
+
+    /**
+     * @brief Get the number of pending WRs of deferred mode.
+     */
+    inline int pending() const { return this->deferred.size(); }
+
+    /**
+     * @brief Enable or disable managed send queue mode.
+     * In managed mode, the connection tracks WRs outstanding in the send queue, signals at least
+     * every `signal_every`-th WR by itself, and returns the credits as completions are polled.
+     * A post that does not fit waits for credits (polling the send CQ) if `blocking`, or returns
+     * EAGAIN otherwise; a chain of more than `Consts::MaxQueueDepth - signal_every` WRs returns
+     * EINVAL. The poll functions return only the completions of WRs signaled by the caller, and
+     * `SendCredits::AutoWrId` is reserved as wr_id.
+     * Enable it before posting anything, on a connection with a send CQ of its own. `PreparedOp`
+     * posts go straight to the QP and are not tracked.
+     *
+     * @param enable If true, enable managed mode.
+     * @param signal_every Maximum number of WRs per completion (at most half the QP depth).
+     * @param blocking If true, posts wait for credits; otherwise they return EAGAIN.
+     * @return int 0 on success, or the status code of the failed flush of pending WRs of deferred
+     * mode, in which case the mode is unchanged.
+     */
+    int set_managed(bool enable, int signal_every = 16, bool blocking = true);
+
+    /**
+     * @brief Get the inline capacity of this QP (see `Cluster::set_max_inline`).
+     * WRITEs and SENDs of at most this many bytes carry their data inside the WR: their source
+     * buffers need not be registered, and can be reused as soon as the post returns.
+     */
+    inline uint32_t inline_threshold() const { return this->max_inline; }
+
+    /**
+     * @brief Post a batch of RDMA one-sided ATOMIC COMPARE-AND-SWAP (CAS) verbs to this QP.
+     * User is responsible to ensure that QP send queue will not overflow, unless in managed mode
+     * (see `set_managed`).
+     * Only the last CAS will generate a CQE.
+     *
+     * @param dst_arr An array of start addresses of remote 8-bytes to CAS. Must have been
+     * registered by the peer.
+     * @param compare_arr An array of local 8-bytes holding the compare values, which are then
+     * overwritten by the original remote values. Must have been registered locally.
+     * @param swap_arr An array of values to swap in.
+     * @param count Number of CAS verbs to post (at most `Consts::MaxPostWR`).
+     * @param wr_id_start The work request ID of the first CAS. Each following CAS will be
+     * assigned an incremented ID.
+     * @param signaled If true, this request will generate ONE completion event in the CQ which must
+     * be later polled.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_batch_atomic_cas(uintptr_t *dst_arr, void **compare_arr, uint64_t *swap_arr,
+                              int count, uint64_t wr_id_start = 0, bool signaled = true);
+
+    /**
+     * @brief Post a batch of RDMA one-sided ATOMIC FETCH-AND-ADD (FAA) verbs to this QP.
+     * User is responsible to ensure that QP send queue will not overflow, unless in managed mode
+     * (see `set_managed`).
+     * Only the last FAA will generate a CQE.
+     *
+     * @param dst_arr An array of start addresses of remote 8-bytes to FAA. Must have been
+     * registered by the peer.
+     * @param fetch_arr An array of destinations to store the fetched 8-bytes. Must have been
+     * registered locally.
+     * @param add_arr An array of values to add.
+     * @param count Number of FAA verbs to post (at most `Consts::MaxPostWR`).
+     * @param wr_id_start The work request ID of the first FAA. Each following FAA will be
+     * assigned an incremented ID.
+     * @param signaled If true, this request will generate ONE completion event in the CQ which must
+     * be later polled.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_batch_atomic_faa(uintptr_t *dst_arr, void **fetch_arr, uint64_t *add_arr, int count,
+                              uint64_t wr_id_start = 0, bool signaled = true);
+
+    /**
+     * @brief Post a batch of RDMA experimental one-sided MASKED ATOMIC COMPARE-AND-SWAP
+     * (MASKED-CAS) verbs to this QP.
+     * User is responsible to ensure that QP send queue will not overflow, unless in managed mode
+     * (see `set_managed`).
+     * Only the last MASKED-CAS will generate a CQE.
+     *
+     * @param dst_arr An array of start addresses of remote 8-bytes to MASKED-CAS. Must have been
+     * registered by the peer.
+     * @param compare_arr An array of local 8-bytes holding the compare values, which are then
+     * overwritten by the original remote values. Must have been registered locally.
+     * @param compare_mask_arr An array of compare masks.
+     * @param swap_arr An array of values to swap in.
+     * @param swap_mask_arr An array of swap masks.
+     * @param count Number of MASKED-CAS verbs to post (at most `Consts::MaxPostWR`).
+     * @param wr_id_start The work request ID of the first MASKED-CAS. Each following MASKED-CAS
+     * will be assigned an incremented ID.
+     * @param signaled If true, this request will generate ONE completion event in the CQ which must
+     * be later polled.
+     * @return int The status code returned by `ibv_exp_post_send` function.
+     */
+    int post_batch_masked_atomic_cas(uintptr_t *dst_arr, void **compare_arr,
+                                     uint64_t *compare_mask_arr, uint64_t *swap_arr,
+                                     uint64_t *swap_mask_arr, int count, uint64_t wr_id_start = 0,
+                                     bool signaled = true);
+
+    // Batched atomics with pre-resolved keys, no MR lookup is performed
+    int post_batch_atomic_cas(RemoteSpan const *dst_arr, LocalSpan const *compare_arr,
+                              uint64_t const *swap_arr, int count, uint64_t wr_id_start = 0,
+                              bool signaled = true);
+    int post_batch_atomic_faa(RemoteSpan const *dst_arr, LocalSpan const *fetch_arr,
+                              uint64_t const *add_arr, int count, uint64_t wr_id_start = 0,
+                              bool signaled = true);
+    int post_batch_masked_atomic_cas(RemoteSpan const *dst_arr, LocalSpan const *compare_arr,
+                                     uint64_t const *compare_mask_arr, uint64_t const *swap_arr,
+                                     uint64_t const *swap_mask_arr, int count,
+                                     uint64_t wr_id_start = 0, bool signaled = true);
+
     void fill_sge(ibv_sge *sge, void *addr, size_t length);
     int post_send(ibv_exp_send_wr *wr);
     int post_recv(ibv_recv_wr *wr);
@@ -251,25 +749,193 @@ class ReliableConnection {
     int poll_recv_cq(ibv_wc *wc_arr, int n = 1);
     int poll_recv_cq_once(ibv_wc *wc_arr, int n = 1);
 
+    /**
+     * @brief Poll RECV completions decoded with their opcode and immediate data.
+     * `poll_recv_cq` waits for exactly `n` completions, `poll_recv_cq_once` polls once.
+     *
+     * @param rc_arr Output, the decoded completions.
+     * @param n Maximum number of completions.
+     * @return int Number of completions polled.
+     */
+    int poll_recv_cq(RecvCompletion *rc_arr, int n = 1);
+    int poll_recv_cq_once(RecvCompletion *rc_arr, int n = 1);
+
+    /**
+     * @brief Poll the send CQ once, along with the time the RNIC completed each work request.
+     * The CQs must be created with timestamps (see `Cluster::set_cq_timestamps`), otherwise every
+     * time is 0. Comparing the time of a post with the completion time gives the latency of the
+     * operation outside the host software. Not available in managed mode.
+     *
+     * @param wc_arr Output, the completions.
+     * @param ts_arr Output, the completion times in host nanoseconds (see `HwClock::to_host_ns`).
+     * @param n Maximum number of completions; at most 32 are polled.
+     * @return int Number of completions polled.
+     */
+    int poll_send_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n = 1);
+
+    /**
+     * @brief Poll the recv CQ once, along with completion times. See `poll_send_cq_timestamped`.
+     */
+    int poll_recv_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n = 1);
+
     inline ibv_cq *get_send_cq() const { return this->send_cq; }
     inline ibv_cq *get_recv_cq() const { return this->recv_cq; }
 
+    /**
+     * @brief Wait for send completions: spin for up to `spin_us` microseconds, then sleep on the
+     * completion channel of the send CQ until one arrives.
+     * Without completion channels (see `Cluster::set_cq_channels`), keeps spinning instead. With
+     * `spin_us == 0` and `timeout_ms == 0`, it never blocks and leaves the CQ armed when it
+     * returns 0, so an epoll loop over `send_cq_fd()` can call it until it returns 0 whenever the
+     * fd becomes readable.
+     *
+     * @param wc_arr Output, the completions.
+     * @param n Maximum number of completions.
+     * @param spin_us Spinning budget in microseconds before sleeping.
+     * @param timeout_ms Maximum time to wait in milliseconds, -1 for no limit.
+     * @return int Number of completions polled, 0 on timeout.
+     */
+    int wait_send_cq(ibv_wc *wc_arr, int n = 1, int spin_us = CompletionChannel::DefaultSpinUs,
+                     int timeout_ms = -1);
+
+    /**
+     * @brief Wait for recv completions. See `wait_send_cq`.
+     */
+    int wait_recv_cq(ibv_wc *wc_arr, int n = 1, int spin_us = CompletionChannel::DefaultSpinUs,
+                     int timeout_ms = -1);
+
+    /**
+     * @brief Get the fd of the completion channel of the send CQ, or -1 if there is none.
+     * It is non-blocking, and readable once the armed CQ receives a completion.
+     */
+    inline int send_cq_fd() const { return this->send_channel.fd(); }
+
+    /**
+     * @brief Get the fd of the completion channel of the recv CQ, or -1 if there is none.
+     */
+    inline int recv_cq_fd() const { return this->recv_channel.fd(); }
+
+    /**
+     * @brief Set the handler of failed completions.
+     * The poll functions of this connection pass every failed completion they see to the handler,
+     * and return it to the caller as well. By default, failed completions are printed to stderr,
+     * except `IBV_WC_WR_FLUSH_ERR` ones that follow the first failure.
+     *
+     * @param handler The handler, or an empty function to restore the default.
+     */
+    inline void set_error_handler(ErrorHandler handler) { this->on_error = std::move(handler); }
+
+    /**
+     * @brief Check whether a failed completion has been polled since establishment or the last
+     * `recover`. The QP is then in the error state, and every post fails or gets flushed.
+     */
+    inline bool has_error() const { return this->in_error; }
+
+    /**
+     * @brief Get the first failed completion polled since establishment or the last `recover`.
+     */
+    inline CompletionError const &last_error() const { return this->first_error; }
+
+    /**
+     * @brief Bring the QP back to RTS in place, after it entered the error state.
+     * The QP is reset and re-connected to the same remote QP (whose number, GID and LID were
+     * stored at establishment), so the `Cluster` and other connections are left untouched.
+     * Both ends must recover, e.g., after agreeing out of band, because their packet sequence
+     * numbers restart. Outstanding WRs are lost: completions still in the CQs are discarded by the
+     * reset, pending WRs of deferred mode are dropped, managed mode credits are returned, and
+     * posted RECVs must be posted again.
+     */
+    void recover();
+
     int verbose() const;
 
   private:
     explicit ReliableConnection(Peer &peer, int id);
-    explicit ReliableConnection(Peer &peer, int id, ibv_cq *send_cq, ibv_cq *recv_cq);
+    explicit ReliableConnection(Peer &peer, int id, ReliableConnection const &cq_owner);
+    explicit ReliableConnection(Peer &peer, int id, SharedCq &shared_cq);
     ~ReliableConnection();
 
-    int create_cq(ibv_cq **cq, int cq_depth = Consts::MaxQueueDepth);
+    int create_cq(ibv_cq **cq, ibv_comp_channel *channel, int cq_depth = Consts::MaxQueueDepth);
     int create_qp(int qp_depth = Consts::MaxQueueDepth);
 
     void fill_exchange(OOBExchange *xchg);
     void establish(ibv_gid gid, int lid, uint32_t qpn);
+    void modify_to_reset();
     void modify_to_init();
     void modify_to_rtr(ibv_gid gid, int lid, uint32_t qpn);
     void modify_to_rts();
 
+    /**
+     * @brief Report failed completions among polled ones.
+     */
+    inline void check(ibv_wc const *wc_arr, int n, bool send)
+    {
+        for (int i = 0; i < n; ++i)
+            if (__glibc_unlikely(wc_arr[i].status != IBV_WC_SUCCESS))
+                this->report(wc_arr[i], send);
+    }
+
+    void report(ibv_wc const &wc, bool send);
+
+    /**
+     * @brief Post a single WR, or append it to the pending chain in deferred mode.
+     */
+    inline int submit(ibv_exp_send_wr *wr)
+    {
+        // A failed flush may have left the chain full, retry it before appending
+        if (__glibc_unlikely(this->deferred.full())) {
+            int rc = this->flush();
+            if (rc != 0)
+                return rc;
+        }
+        if (__glibc_unlikely(this->credits.enabled())) {
+            int rc = this->admit(wr);
+            if (rc != 0)
+                return rc;
+        }
+        if (__glibc_likely(!this->deferred.enabled())) {
+            ibv_exp_send_wr *bad_wr;
+            return ibv_exp_post_send(this->qp, wr, &bad_wr);
+        }
+        return this->deferred.append(wr) ? this->flush() : 0;
+    }
+
+    /**
+     * @brief Flush the pending chain ahead of an operation that bypasses it.
+     * @return int Same as `flush`.
+     */
+    inline int flush_pending()
+    {
+        return __glibc_unlikely(this->deferred.size() > 0) ? this->flush() : 0;
+    }
+
+    /**
+     * @brief Take send queue credits for a list of WRs in managed mode.
+     * @return int 0 on success, EAGAIN if no credits (non-blocking), EINVAL if too many WRs.
+     */
+    int admit(ibv_exp_send_wr *wr);
+
+    inline int poll_send_raw(int n, ibv_wc *wc_arr)
+    {
+        int res = __glibc_unlikely(this->credits.enabled())
+                      ? this->credits.poll(this->send_cq, wc_arr, n)
+                      : ibv_poll_cq(this->send_cq, n, wc_arr);
+        if (res > 0)
+            this->check(wc_arr, res, true);
+        return res;
+    }
+
+    /**
+     * @brief Poll the recv CQ once.
+     */
+    inline int poll_recv_raw(int n, ibv_wc *wc_arr)
+    {
+        int res = ibv_poll_cq(this->recv_cq, n, wc_arr);
+        if (res > 0)
+            this->check(wc_arr, res, false);
+        return res;
+    }
+
     static const int InitPSN = 3185;
 
     Context *ctx;
@@ -281,6 +947,22 @@ class ReliableConnection {
     ibv_cq *send_cq;
     ibv_cq *recv_cq;
     bool cq_self;
+    CompletionChannel send_channel;  // Of the send CQ, owned along with it
+    CompletionChannel recv_channel;  // Of the recv CQ, owned along with it
+    uint32_t max_inline;
+
+    DeferredChain deferred;
+    int flush_error;  // Of the last flush
+    SendCredits credits;
+
+    // Remote end, kept for `recover`
+    ibv_gid remote_gid;
+    int remote_lid;
+    uint32_t remote_qpn;
+
+    ErrorHandler on_error;
+    bool in_error;
+    CompletionError first_error;
 };
 
 }  // namespace rdma
@@ -18,11 +18,6 @@ namespace rdma {
  */
 class Consts {
   public:
-    /**
-     * @brief Maximum number of allowed memory regions per Context.
-     */
-    static const int MaxMrs = 4;
-
     /**
      * @brief Maximum number of allowed peers (including myself) per Cluster.
      */
@@ -43,6 +38,16 @@ class Consts {
      * @brief Maximum number of WRs to be posted at the same time.
      */
     static const int MaxPostWR = 32;
+
+    /**
+     * @brief Maximum number of scatter/gather entries of each WR.
+     */
+    static const int MaxSge = 16;
+
+    /**
+     * @brief Maximum bytes of data inlined into a WR.
+     */
+    static const int MaxInlineData = 256;
 };
 
 class Context;
@@ -51,6 +56,11 @@ class Peer;
 
 class ReliableConnection;
 class ExtendedReliableConnection;
+class MultiRail;
+class WrChain;
+class CompletionChannel;
+class SharedCq;
+class HwClock;
 
 class Emergency {
     friend class Context;
@@ -58,6 +68,11 @@ class Emergency {
     friend class Peer;
     friend class ReliableConnection;
     friend class ExtendedReliableConnection;
+    friend class MultiRail;
+    friend class WrChain;
+    friend class CompletionChannel;
+    friend class SharedCq;
+    friend class HwClock;
 
     [[noreturn]] inline static void abort(const std::string &message, int retval = -1)
     {
@@ -0,0 +1,123 @@
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+
+#include "reg_cache.h"
+
+namespace rdma {
+
+RegistrationCache::RegistrationCache(Context &ctx, size_t budget)
+    : ctx(&ctx), budget(budget), registered_bytes(0), max_length(0)
+{
+}
+
+RegistrationCache::~RegistrationCache()
+{
+    for (auto &[start, entry] : this->entries)
+        ibv_dereg_mr(entry.mr);
+    this->release();
+}
+
+bool RegistrationCache::supported(Context const &ctx)
+{
+    // Cached lkeys are read by SENDs and WRITEs, and written by READs and atomics
+    static const uint32_t LocalAccess = IBV_EXP_ODP_SUPPORT_SEND | IBV_EXP_ODP_SUPPORT_WRITE |
+                                        IBV_EXP_ODP_SUPPORT_READ | IBV_EXP_ODP_SUPPORT_ATOMIC;
+
+    ibv_exp_odp_caps const &caps = ctx.device_attr.odp_caps;
+    return (ctx.device_attr.exp_device_cap_flags & IBV_EXP_DEVICE_ODP) &&
+           (caps.general_odp_caps & IBV_EXP_ODP_SUPPORT) &&
+           (caps.per_transport_caps.rc_odp_caps & LocalAccess) == LocalAccess;
+}
+
+bool RegistrationCache::lookup(void const *addr, size_t size, uint32_t *lkey)
+{
+    static const uintptr_t PageBytes = sysconf(_SC_PAGESIZE);
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t end = start + size;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // Hit: an entry starting at or below `start`, close enough to reach it, covers the range
+    auto it = this->entries.upper_bound({start, UINTPTR_MAX});
+    while (it != this->entries.begin()) {
+        --it;
+        if (it->first.first + this->max_length <= start)
+            break;
+        if (end <= it->first.second) {
+            this->lru.splice(this->lru.begin(), this->lru, it->second.lru_pos);
+            *lkey = it->second.mr->lkey;
+            return true;
+        }
+    }
+
+    // Miss: register the page-aligned range alone, overlapping entries may be in use
+    start &= ~(PageBytes - 1);
+    end = (end + PageBytes - 1) & ~(PageBytes - 1);
+    if (end - start > this->budget)
+        return false;
+    while (this->registered_bytes + (end - start) > this->budget)
+        this->erase(this->entries.find(this->lru.back()));
+
+    ibv_exp_reg_mr_in in;
+    memset(&in, 0, sizeof(ibv_exp_reg_mr_in));
+    in.pd = this->ctx->pd;
+    in.addr = reinterpret_cast<void *>(start);
+    in.length = end - start;
+    in.exp_access = IBV_ACCESS_LOCAL_WRITE | IBV_EXP_ACCESS_ON_DEMAND;
+    ibv_mr *mr = ibv_exp_reg_mr(&in);
+    if (mr == nullptr)
+        return false;
+
+    // Fault the pages in now rather than on the first WR (best effort, e.g., not if read-only)
+    ibv_exp_prefetch_attr attr;
+    memset(&attr, 0, sizeof(ibv_exp_prefetch_attr));
+    attr.flags = IBV_EXP_PREFETCH_WRITE_ACCESS;
+    attr.addr = in.addr;
+    attr.length = in.length;
+    ibv_exp_prefetch_mr(mr, &attr);
+
+    this->lru.push_front({start, end});
+    this->entries.emplace(Range{start, end}, Entry{mr, this->lru.begin()});
+    this->registered_bytes += end - start;
+    this->max_length = std::max<size_t>(this->max_length, end - start);
+    *lkey = mr->lkey;
+    return true;
+}
+
+void RegistrationCache::invalidate(void const *addr, size_t size)
+{
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t end = start + size;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    uintptr_t lowest = start > this->max_length ? start - this->max_length : 0;
+    auto it = this->entries.lower_bound({lowest, 0});
+    while (it != this->entries.end() && it->first.first < end) {
+        if (it->first.second > start)
+            this->erase(it++);
+        else
+            ++it;
+    }
+}
+
+void RegistrationCache::release()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (ibv_mr *mr : this->retired)
+        ibv_dereg_mr(mr);
+    this->retired.clear();
+}
+
+void RegistrationCache::erase(std::map<Range, Entry>::iterator it)
+{
+    // WRs in flight may still use the lkey, so keep it valid until `release`
+    this->retired.push_back(it->second.mr);
+    this->registered_bytes -= it->first.second - it->first.first;
+    this->lru.erase(it->second.lru_pos);
+    this->entries.erase(it);
+}
+
+}  // namespace rdma
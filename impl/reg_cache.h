@@ -0,0 +1,108 @@
+#if !defined(__REG_CACHE_H__)
+#define __REG_CACHE_H__
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "context.h"
+
+namespace rdma {
+
+/**
+ * @brief Registration cache of arbitrary local buffers, owned by a Context.
+ * A buffer that misses the explicit MRs is registered (page-aligned) on first use, and later
+ * uses of any range it covers reuse the registration. A range that no single registration covers
+ * gets a registration of its own, even if it overlaps cached ones.
+ *
+ * Registrations are on-demand paging (ODP) MRs: they pin nothing, and the kernel invalidates the
+ * RNIC's translations whenever pages are unmapped or remapped, so a cached lkey never reaches
+ * recycled pages, whatever happens to the memory behind it.
+ *
+ * Least-recently-used registrations are evicted to keep the registered bytes under the budget,
+ * and `invalidate` evicts registrations of a range. Evicted registrations leave the cache but
+ * stay valid, as WRs in flight (or spans) may still use their lkeys; `release` deregisters them
+ * once the caller knows those WRs have completed.
+ */
+class RegistrationCache {
+    friend class Context;
+
+  public:
+    RegistrationCache(RegistrationCache const &) = delete;
+    RegistrationCache(RegistrationCache &&) = delete;
+
+    /**
+     * @brief Match a local range to a cached registration, registering it on a miss.
+     *
+     * @param addr Start address of the range.
+     * @param size Length in bytes of the range.
+     * @param lkey Output, the lkey of the registration.
+     * @return true On success; false if the range cannot be registered within the budget.
+     */
+    bool lookup(void const *addr, size_t size, uint32_t *lkey);
+
+    /**
+     * @brief Evict every cached registration overlapping a range.
+     *
+     * @param addr Start address of the range.
+     * @param size Length in bytes of the range.
+     */
+    void invalidate(void const *addr, size_t size);
+
+    /**
+     * @brief Deregister evicted registrations. Call it only when no WR posted before (and no span
+     * resolved before) through the cache is still in use.
+     */
+    void release();
+
+    /**
+     * @brief Get the bytes currently registered by the cache, not counting evicted registrations.
+     */
+    inline size_t registered() const
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->registered_bytes;
+    }
+
+    /**
+     * @brief Get the number of evicted registrations not released yet.
+     */
+    inline size_t evicted() const
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->retired.size();
+    }
+
+    /**
+     * @brief Check whether the RNIC supports the ODP registrations the cache needs.
+     */
+    static bool supported(Context const &ctx);
+
+  private:
+    explicit RegistrationCache(Context &ctx, size_t budget);
+    ~RegistrationCache();
+
+    using Range = std::pair<uintptr_t, uintptr_t>;  // [start, end)
+
+    struct Entry {
+        ibv_mr *mr;
+        std::list<Range>::iterator lru_pos;
+    };
+
+    void erase(std::map<Range, Entry>::iterator it);
+
+    Context *ctx;
+    size_t budget;
+    size_t registered_bytes;
+    size_t max_length;  // Of all registrations so far, bounds the search for covering ones
+
+    mutable std::mutex mutex;
+    std::map<Range, Entry> entries;  // May overlap
+    std::list<Range> lru;            // Most recently used first
+    std::vector<ibv_mr *> retired;   // Evicted, still registered until `release`
+};
+
+}  // namespace rdma
+
+#endif  // __REG_CACHE_H__
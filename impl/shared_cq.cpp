@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "context.h"
+#include "rc/rc.h"
+#include "shared_cq.h"
+
+namespace rdma {
+
+SharedCq::SharedCq(Context &ctx, int id, int cq_depth, bool channel, bool timestamps)
+    : ctx(&ctx), conn_id(id)
+{
+    if (channel) {
+        this->send_channel.open(ctx.get_ctx());
+        this->recv_channel.open(ctx.get_ctx());
+    }
+
+    ibv_exp_cq_init_attr attr;
+    memset(&attr, 0, sizeof(ibv_exp_cq_init_attr));
+    if (timestamps) {
+        attr.comp_mask = IBV_EXP_CQ_INIT_ATTR_FLAGS;
+        attr.flags = IBV_EXP_CQ_TIMESTAMP;
+    }
+    this->send_cq = ibv_exp_create_cq(ctx.get_ctx(), cq_depth, nullptr, this->send_channel.get(),
+                                      0, &attr);
+    this->recv_cq = ibv_exp_create_cq(ctx.get_ctx(), cq_depth, nullptr, this->recv_channel.get(),
+                                      0, &attr);
+    if (this->send_cq == nullptr || this->recv_cq == nullptr)
+        Emergency::abort("failed to create shared CQs");
+}
+
+SharedCq::~SharedCq()
+{
+    ibv_destroy_cq(this->send_cq);
+    ibv_destroy_cq(this->recv_cq);
+    this->send_channel.close();
+    this->recv_channel.close();
+}
+
+int SharedCq::poll_send_cq(ibv_wc *wc_arr, int n)
+{
+    int res = ibv_poll_cq(this->send_cq, n, wc_arr);
+    if (res > 0)
+        this->check(wc_arr, res, true);
+    return res;
+}
+
+int SharedCq::poll_recv_cq(ibv_wc *wc_arr, int n)
+{
+    int res = ibv_poll_cq(this->recv_cq, n, wc_arr);
+    if (res > 0)
+        this->check(wc_arr, res, false);
+    return res;
+}
+
+int SharedCq::poll_send_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n)
+{
+    int res = poll_cq_timestamped(this->send_cq, this->ctx->hw_clock(), wc_arr, ts_arr, n);
+    if (res > 0)
+        this->check(wc_arr, res, true);
+    return res;
+}
+
+int SharedCq::poll_recv_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n)
+{
+    int res = poll_cq_timestamped(this->recv_cq, this->ctx->hw_clock(), wc_arr, ts_arr, n);
+    if (res > 0)
+        this->check(wc_arr, res, false);
+    return res;
+}
+
+int SharedCq::wait_send_cq(ibv_wc *wc_arr, int n, int spin_us, int timeout_ms)
+{
+    auto poll_once = [this](ibv_wc *wc_arr, int n) { return this->poll_send_cq(wc_arr, n); };
+    return this->send_channel.wait(this->send_cq, poll_once, wc_arr, n, spin_us, timeout_ms);
+}
+
+int SharedCq::wait_recv_cq(ibv_wc *wc_arr, int n, int spin_us, int timeout_ms)
+{
+    auto poll_once = [this](ibv_wc *wc_arr, int n) { return this->poll_recv_cq(wc_arr, n); };
+    return this->recv_channel.wait(this->recv_cq, poll_once, wc_arr, n, spin_us, timeout_ms);
+}
+
+void SharedCq::check(ibv_wc const *wc_arr, int n, bool send)
+{
+    for (int i = 0; i < n; ++i) {
+        if (__glibc_likely(wc_arr[i].status == IBV_WC_SUCCESS))
+            continue;
+        ReliableConnection *rc = this->rc_of(wc_arr[i]);
+        if (rc)
+            rc->report(wc_arr[i], send);
+    }
+}
+
+}  // namespace rdma
@@ -0,0 +1,117 @@
+#if !defined(__SHARED_CQ_H__)
+#define __SHARED_CQ_H__
+
+#include <unordered_map>
+
+#include "channel.h"
+#include "rdma_base.h"
+
+namespace rdma {
+
+/**
+ * @brief A send CQ and a recv CQ shared by connection `id` to every peer.
+ * Created by `Cluster::establish` with `CqSharing::PerThread`. A worker thread that owns
+ * connection `id` to all peers polls this pair instead of one CQ pair per peer, and tells the
+ * completions apart by their QP numbers (see `peer_of` and `rc_of`).
+ *
+ * The poll functions report failed completions to their connections (see
+ * `ReliableConnection::set_error_handler`). They do not flush deferred WRs, so flush the
+ * connections before polling. Managed mode is not available on connections with shared CQs.
+ */
+class SharedCq {
+    friend class Cluster;
+    friend class ReliableConnection;
+
+  public:
+    SharedCq(SharedCq const &) = delete;
+    SharedCq(SharedCq &&) = delete;
+
+    /**
+     * @brief Get the ID of the connections sharing this CQ pair.
+     */
+    inline int id() const { return this->conn_id; }
+
+    /**
+     * @brief Poll the send CQ once.
+     *
+     * @param wc_arr Output, the completions.
+     * @param n Maximum number of completions.
+     * @return int Number of completions polled.
+     */
+    int poll_send_cq(ibv_wc *wc_arr, int n = 1);
+
+    /**
+     * @brief Poll the recv CQ once.
+     *
+     * @param wc_arr Output, the completions.
+     * @param n Maximum number of completions.
+     * @return int Number of completions polled.
+     */
+    int poll_recv_cq(ibv_wc *wc_arr, int n = 1);
+
+    // Completion times stamped by the RNIC, see `ReliableConnection::poll_send_cq_timestamped`
+    int poll_send_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n = 1);
+    int poll_recv_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n = 1);
+
+    // Spin-then-block waiting and channel fds, see `ReliableConnection::wait_send_cq`
+    int wait_send_cq(ibv_wc *wc_arr, int n = 1, int spin_us = CompletionChannel::DefaultSpinUs,
+                     int timeout_ms = -1);
+    int wait_recv_cq(ibv_wc *wc_arr, int n = 1, int spin_us = CompletionChannel::DefaultSpinUs,
+                     int timeout_ms = -1);
+    inline int send_cq_fd() const { return this->send_channel.fd(); }
+    inline int recv_cq_fd() const { return this->recv_channel.fd(); }
+
+    /**
+     * @brief Get the connection that a completion belongs to.
+     * @return ReliableConnection* The connection, or nullptr if its QP is not on this CQ pair.
+     */
+    inline ReliableConnection *rc_of(ibv_wc const &wc) const
+    {
+        auto it = this->qps.find(wc.qp_num);
+        return it == this->qps.end() ? nullptr : it->second.rc;
+    }
+
+    /**
+     * @brief Get the peer that a completion comes from.
+     * @return int The peer ID, or -1 if its QP is not on this CQ pair.
+     */
+    inline int peer_of(ibv_wc const &wc) const
+    {
+        auto it = this->qps.find(wc.qp_num);
+        return it == this->qps.end() ? -1 : it->second.peer_id;
+    }
+
+    inline ibv_cq *get_send_cq() const { return this->send_cq; }
+    inline ibv_cq *get_recv_cq() const { return this->recv_cq; }
+
+  private:
+    struct Source {
+        ReliableConnection *rc;
+        int peer_id;
+    };
+
+    explicit SharedCq(Context &ctx, int id, int cq_depth, bool channel, bool timestamps);
+    ~SharedCq();
+
+    /**
+     * @brief Register a connection whose QP reports into this CQ pair.
+     */
+    inline void add(ReliableConnection *rc, uint32_t qp_num, int peer_id)
+    {
+        this->qps[qp_num] = {rc, peer_id};
+    }
+
+    void check(ibv_wc const *wc_arr, int n, bool send);
+
+    Context *ctx;
+    int conn_id;
+    ibv_cq *send_cq;
+    ibv_cq *recv_cq;
+    CompletionChannel send_channel;
+    CompletionChannel recv_channel;
+    std::unordered_map<uint32_t, Source> qps;
+};
+
+}  // namespace rdma
+
+#endif  // __SHARED_CQ_H__
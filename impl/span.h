@@ -0,0 +1,80 @@
+#if !defined(__SPAN_H__)
+#define __SPAN_H__
+
+#include <infiniband/verbs.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace rdma {
+
+/**
+ * @brief A locally registered buffer whose lkey has been resolved in advance.
+ * Obtain one from `Context::local_span` and pass it to the post functions to skip the per-post
+ * MR lookup. Carving sub-spans does not perform any lookup either.
+ */
+struct LocalSpan {
+    void *addr;
+    size_t size;
+    uint32_t lkey;
+
+    /**
+     * @brief Get a sub-span sharing the same lkey.
+     *
+     * @param offset Offset in bytes from the start of this span.
+     * @param len Length in bytes of the sub-span.
+     * @return LocalSpan The sub-span.
+     */
+    inline LocalSpan sub(size_t offset, size_t len) const
+    {
+        return {reinterpret_cast<char *>(addr) + offset, len, lkey};
+    }
+
+    /**
+     * @brief Get the start address as an integer.
+     */
+    inline uintptr_t uaddr() const { return reinterpret_cast<uintptr_t>(addr); }
+};
+
+/**
+ * @brief A buffer registered by a peer whose rkey has been resolved in advance.
+ * Obtain one from `Peer::remote_span` and pass it to the post functions to skip the per-post
+ * remote MR lookup.
+ */
+struct RemoteSpan {
+    uintptr_t addr;
+    size_t size;
+    uint32_t rkey;
+
+    /**
+     * @brief Get a sub-span sharing the same rkey.
+     *
+     * @param offset Offset in bytes from the start of this span.
+     * @param len Length in bytes of the sub-span.
+     * @return RemoteSpan The sub-span.
+     */
+    inline RemoteSpan sub(size_t offset, size_t len) const { return {addr + offset, len, rkey}; }
+};
+
+/**
+ * @brief Fill scatter/gather entries from local spans.
+ *
+ * @param sge Output, the scatter/gather entries.
+ * @param spans The local spans, in order.
+ * @param count Number of spans.
+ * @return size_t Total length in bytes of the spans.
+ */
+inline size_t fill_sges(ibv_sge *sge, LocalSpan const *spans, int count)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        sge[i].addr = spans[i].uaddr();
+        sge[i].length = spans[i].size;
+        sge[i].lkey = spans[i].lkey;
+        total += spans[i].size;
+    }
+    return total;
+}
+
+}  // namespace rdma
+
+#endif  // __SPAN_H__
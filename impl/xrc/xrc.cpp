@@ -13,11 +13,18 @@ ExtendedReliableConnection::ExtendedReliableConnection(Peer &peer, int id)
 
     this->peer = &peer;
     this->id = id;
+    this->max_inline = 0;
+    this->in_error = false;
+    this->flush_error = 0;
 
     // Create QP
-    this->create_cq(&this->send_cq);
-    this->create_cq(&this->recv_cq);
-    this->create_cq(&this->placeholder_cq, 4);
+    if (this->cluster->cq_channels) {
+        this->send_channel.open(this->ctx->ctx);
+        this->recv_channel.open(this->ctx->ctx);
+    }
+    this->create_cq(&this->send_cq, this->send_channel.get());
+    this->create_cq(&this->recv_cq, this->recv_channel.get());
+    this->create_cq(&this->placeholder_cq, nullptr, 4);
 
     this->create_srq(&this->srq, this->recv_cq);
 
@@ -33,6 +40,8 @@ ExtendedReliableConnection::~ExtendedReliableConnection()
     ibv_destroy_cq(this->send_cq);
     ibv_destroy_cq(this->recv_cq);
     ibv_destroy_cq(this->placeholder_cq);
+    this->send_channel.close();
+    this->recv_channel.close();
 
     // Dereference the RDMA context
     this->ctx->refcnt.fetch_sub(1);
@@ -41,145 +50,304 @@ ExtendedReliableConnection::~ExtendedReliableConnection()
 int ExtendedReliableConnection::post_read(void *dst, uintptr_t src, size_t size, bool signaled,
                                           uint64_t wr_id)
 {
-    ibv_exp_send_wr wr, *bad_wr;
+    return this->post_read(this->ctx->local_span(dst, size), this->peer->remote_span(src, size),
+                           signaled, wr_id);
+}
+
+int ExtendedReliableConnection::post_read(LocalSpan const &dst, RemoteSpan const &src,
+                                          bool signaled, uint64_t wr_id)
+{
+    if (signaled)
+        return this->post<IBV_EXP_WR_RDMA_READ>(src, dst, wr_id);
+    return this->post<IBV_EXP_WR_RDMA_READ, 0>(src, dst, wr_id);
+}
+
+int ExtendedReliableConnection::post_write(uintptr_t dst, void const *src, size_t size,
+                                           bool signaled, uint64_t wr_id)
+{
+    if (size <= this->max_inline)
+        return this->post_write(this->peer->remote_span(dst, size),
+                                LocalSpan{const_cast<void *>(src), size, 0}, signaled, wr_id);
+    return this->post_write(this->peer->remote_span(dst, size),
+                            this->ctx->local_span(const_cast<void *>(src), size), signaled, wr_id);
+}
+
+int ExtendedReliableConnection::post_write(RemoteSpan const &dst, LocalSpan const &src,
+                                           bool signaled, uint64_t wr_id)
+{
+    if (src.size > this->max_inline) {
+        if (signaled)
+            return this->post<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_SIGNALED>(dst, src, wr_id);
+        return this->post<IBV_EXP_WR_RDMA_WRITE, 0>(dst, src, wr_id);
+    }
+    if (signaled)
+        return this->post<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_SIGNALED | IBV_EXP_SEND_INLINE>(
+            dst, src, wr_id);
+    return this->post<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_INLINE>(dst, src, wr_id);
+}
+
+int ExtendedReliableConnection::post_send(void const *src, size_t size, int remote_id,
+                                          bool signaled, uint64_t wr_id)
+{
+    if (size <= this->max_inline)
+        return this->post_send(LocalSpan{const_cast<void *>(src), size, 0}, remote_id, signaled,
+                               wr_id);
+    return this->post_send(this->ctx->local_span(const_cast<void *>(src), size), remote_id,
+                           signaled, wr_id);
+}
+
+int ExtendedReliableConnection::post_send(LocalSpan const &src, int remote_id, bool signaled,
+                                          uint64_t wr_id)
+{
+    if (src.size > this->max_inline) {
+        if (signaled)
+            return this->post<IBV_EXP_WR_SEND, IBV_EXP_SEND_SIGNALED>(src, remote_id, wr_id);
+        return this->post<IBV_EXP_WR_SEND, 0>(src, remote_id, wr_id);
+    }
+    if (signaled)
+        return this->post<IBV_EXP_WR_SEND, IBV_EXP_SEND_SIGNALED | IBV_EXP_SEND_INLINE>(
+            src, remote_id, wr_id);
+    return this->post<IBV_EXP_WR_SEND, IBV_EXP_SEND_INLINE>(src, remote_id, wr_id);
+}
+
+PreparedOp ExtendedReliableConnection::prepare(ibv_exp_wr_opcode opcode, bool signaled,
+                                               int remote_id)
+{
+    switch (opcode) {
+    case IBV_EXP_WR_SEND:
+        return PreparedOp(this->ini_qp, opcode, signaled, this->peer->xrc_srq_nums[remote_id]);
+    case IBV_EXP_WR_RDMA_READ:
+    case IBV_EXP_WR_RDMA_WRITE:
+    case IBV_EXP_WR_ATOMIC_CMP_AND_SWP:
+    case IBV_EXP_WR_ATOMIC_FETCH_AND_ADD:
+        return PreparedOp(this->ini_qp, opcode, signaled, this->peer->xrc_srq_nums[this->id]);
+    default:
+        Emergency::abort("cannot prepare opcode " + std::to_string(opcode));
+    }
+}
+
+int ExtendedReliableConnection::post_recv(void *dst, size_t size, uint64_t wr_id)
+{
+    return this->post_recv(this->ctx->local_span(dst, size), wr_id);
+}
+
+int ExtendedReliableConnection::post_recv(LocalSpan const &dst, uint64_t wr_id)
+{
+    ibv_recv_wr wr, *bad_wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(dst);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(dst, size);
+    sge.addr = dst.uaddr();
+    sge.length = dst.size;
+    sge.lkey = dst.lkey;
 
     memset(&wr, 0, sizeof(wr));
     wr.next = nullptr;
     wr.wr_id = wr_id;
     wr.sg_list = &sge;
     wr.num_sge = 1;
+
+    return ibv_post_srq_recv(this->srq, &wr, &bad_wr);
+}
+
+int ExtendedReliableConnection::post_write_imm(uintptr_t dst, void const *src, size_t size,
+                                               uint32_t imm, int remote_id, bool signaled,
+                                               uint64_t wr_id)
+{
+    LocalSpan local = size <= this->max_inline
+                          ? LocalSpan{const_cast<void *>(src), size, 0}
+                          : this->ctx->local_span(const_cast<void *>(src), size);
+    return this->post_write_imm(this->peer->remote_span(dst, size), local, imm, remote_id,
+                                signaled, wr_id);
+}
+
+int ExtendedReliableConnection::post_write_imm(RemoteSpan const &dst, LocalSpan const &src,
+                                               uint32_t imm, int remote_id, bool signaled,
+                                               uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
+    ibv_sge sge;
+    sge.addr = src.uaddr();
+    sge.length = src.size;
+    sge.lkey = src.lkey;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = &sge;
+    wr.num_sge = src.size > 0 ? 1 : 0;
+    wr.exp_opcode = IBV_EXP_WR_RDMA_WRITE_WITH_IMM;
+    if (signaled)
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    if (src.size <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    wr.ex.imm_data = htonl(imm);
+    wr.wr.rdma.remote_addr = dst.addr;
+    wr.wr.rdma.rkey = dst.rkey;
+    wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[remote_id];
+
+    return this->submit(&wr);
+}
+
+int ExtendedReliableConnection::post_send_imm(void const *src, size_t size, uint32_t imm,
+                                              int remote_id, bool signaled, uint64_t wr_id)
+{
+    LocalSpan local = size <= this->max_inline
+                          ? LocalSpan{const_cast<void *>(src), size, 0}
+                          : this->ctx->local_span(const_cast<void *>(src), size);
+    return this->post_send_imm(local, imm, remote_id, signaled, wr_id);
+}
+
+int ExtendedReliableConnection::post_send_imm(LocalSpan const &src, uint32_t imm, int remote_id,
+                                              bool signaled, uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
+    ibv_sge sge;
+    sge.addr = src.uaddr();
+    sge.length = src.size;
+    sge.lkey = src.lkey;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = &sge;
+    wr.num_sge = src.size > 0 ? 1 : 0;
+    wr.exp_opcode = IBV_EXP_WR_SEND_WITH_IMM;
+    if (signaled)
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    if (src.size <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    wr.ex.imm_data = htonl(imm);
+    wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[remote_id];
+
+    return this->submit(&wr);
+}
+
+int ExtendedReliableConnection::post_read(LocalSpan const *dst, int count, RemoteSpan const &src,
+                                          bool signaled, uint64_t wr_id)
+{
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
+    ibv_exp_send_wr wr;
+    ibv_sge sge[Consts::MaxSge];
+    fill_sges(sge, dst, count);
+
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = sge;
+    wr.num_sge = count;
     wr.exp_opcode = IBV_EXP_WR_RDMA_READ;
     if (signaled)
         wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
-    wr.wr.rdma.remote_addr = src;
-    wr.wr.rdma.rkey = this->peer->match_remote_mr_rkey(src, size);
+    wr.wr.rdma.remote_addr = src.addr;
+    wr.wr.rdma.rkey = src.rkey;
     wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[this->id];  // Must specify one
 
-    return ibv_exp_post_send(this->ini_qp, &wr, &bad_wr);
+    return this->submit(&wr);
 }
 
-int ExtendedReliableConnection::post_write(uintptr_t dst, void const *src, size_t size,
+int ExtendedReliableConnection::post_write(RemoteSpan const &dst, LocalSpan const *src, int count,
                                            bool signaled, uint64_t wr_id)
 {
-    ibv_exp_send_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(src);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(src, size);
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
+    ibv_exp_send_wr wr;
+    ibv_sge sge[Consts::MaxSge];
+    size_t total = fill_sges(sge, src, count);
 
     memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
     wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
+    wr.sg_list = sge;
+    wr.num_sge = count;
     wr.exp_opcode = IBV_EXP_WR_RDMA_WRITE;
     if (signaled)
         wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
-    wr.wr.rdma.remote_addr = dst;
-    wr.wr.rdma.rkey = this->peer->match_remote_mr_rkey(dst, size);
+    if (total <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    wr.wr.rdma.remote_addr = dst.addr;
+    wr.wr.rdma.rkey = dst.rkey;
     wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[this->id];  // Must specify one
 
-    return ibv_exp_post_send(this->ini_qp, &wr, &bad_wr);
+    return this->submit(&wr);
 }
 
-int ExtendedReliableConnection::post_send(void const *src, size_t size, int remote_id,
+int ExtendedReliableConnection::post_send(LocalSpan const *src, int count, int remote_id,
                                           bool signaled, uint64_t wr_id)
 {
-    ibv_exp_send_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(src);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(src, size);
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
+    ibv_exp_send_wr wr;
+    ibv_sge sge[Consts::MaxSge];
+    size_t total = fill_sges(sge, src, count);
 
     memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
     wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
+    wr.sg_list = sge;
+    wr.num_sge = count;
     wr.exp_opcode = IBV_EXP_WR_SEND;
     if (signaled)
         wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    if (total <= this->max_inline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
     wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[remote_id];
 
-    return ibv_exp_post_send(this->ini_qp, &wr, &bad_wr);
+    return this->submit(&wr);
 }
 
-int ExtendedReliableConnection::post_recv(void *dst, size_t size, uint64_t wr_id)
+int ExtendedReliableConnection::post_recv(LocalSpan const *dst, int count, uint64_t wr_id)
 {
+    if (count <= 0 || count > Consts::MaxSge)
+        return EINVAL;
+
     ibv_recv_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(dst);
-    sge.length = size;
-    sge.lkey = this->ctx->match_mr_lkey(dst, size);
+    ibv_sge sge[Consts::MaxSge];
+    fill_sges(sge, dst, count);
 
     memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
     wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-
+    wr.sg_list = sge;
+    wr.num_sge = count;
     return ibv_post_srq_recv(this->srq, &wr, &bad_wr);
 }
 
 int ExtendedReliableConnection::post_atomic_cas(uintptr_t dst, void *compare, uint64_t swap,
                                                 bool signaled, uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
-        Emergency::abort("post atomic CAS to non-aligned address");
+    return this->post_atomic_cas(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                 this->ctx->local_span(compare, sizeof(uint64_t)), swap, signaled,
+                                 wr_id);
+}
 
-    ibv_exp_send_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(compare);
-    sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(compare, sizeof(uint64_t));
+int ExtendedReliableConnection::post_atomic_cas(RemoteSpan const &dst, LocalSpan const &compare,
+                                                uint64_t swap, bool signaled, uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
+        Emergency::abort("post atomic CAS to non-aligned address");
 
-    memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
-    wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.exp_opcode = IBV_EXP_WR_ATOMIC_CMP_AND_SWP;
+    uint64_t compare_val = *(reinterpret_cast<uint64_t *>(compare.addr));
     if (signaled)
-        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
-    wr.wr.atomic.remote_addr = dst;
-    wr.wr.atomic.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
-    wr.wr.atomic.compare_add = *(reinterpret_cast<uint64_t *>(compare));
-    wr.wr.atomic.swap = swap;
-    wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[this->id];  // Must specify one
-
-    return ibv_exp_post_send(this->ini_qp, &wr, &bad_wr);
+        return this->post_atomic<IBV_EXP_WR_ATOMIC_CMP_AND_SWP>(dst, compare, compare_val, swap,
+                                                                wr_id);
+    return this->post_atomic<IBV_EXP_WR_ATOMIC_CMP_AND_SWP, 0>(dst, compare, compare_val, swap,
+                                                               wr_id);
 }
 
 int ExtendedReliableConnection::post_atomic_faa(uintptr_t dst, void *fetch, uint64_t add,
                                                 bool signaled, uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
-        Emergency::abort("post atomic FA to non-aligned address");
+    return this->post_atomic_faa(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                 this->ctx->local_span(fetch, sizeof(uint64_t)), add, signaled,
+                                 wr_id);
+}
 
-    ibv_exp_send_wr wr, *bad_wr;
-    ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(fetch);
-    sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(fetch, sizeof(uint64_t));
+int ExtendedReliableConnection::post_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch,
+                                                uint64_t add, bool signaled, uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
+        Emergency::abort("post atomic FA to non-aligned address");
 
-    memset(&wr, 0, sizeof(wr));
-    wr.next = nullptr;
-    wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.exp_opcode = IBV_EXP_WR_ATOMIC_FETCH_AND_ADD;
     if (signaled)
-        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
-    wr.wr.atomic.remote_addr = dst;
-    wr.wr.atomic.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
-    wr.wr.atomic.compare_add = add;
-    wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[this->id];  // Must specify one
-
-    return ibv_exp_post_send(this->ini_qp, &wr, &bad_wr);
+        return this->post_atomic<IBV_EXP_WR_ATOMIC_FETCH_AND_ADD>(dst, fetch, add, 0, wr_id);
+    return this->post_atomic<IBV_EXP_WR_ATOMIC_FETCH_AND_ADD, 0>(dst, fetch, add, 0, wr_id);
 }
 
 int ExtendedReliableConnection::post_masked_atomic_cas(uintptr_t dst, void *compare,
@@ -187,14 +355,25 @@ int ExtendedReliableConnection::post_masked_atomic_cas(uintptr_t dst, void *comp
                                                        uint64_t swap_mask, bool signaled,
                                                        uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
+    return this->post_masked_atomic_cas(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                        this->ctx->local_span(compare, sizeof(uint64_t)),
+                                        compare_mask, swap, swap_mask, signaled, wr_id);
+}
+
+int ExtendedReliableConnection::post_masked_atomic_cas(RemoteSpan const &dst,
+                                                       LocalSpan const &compare,
+                                                       uint64_t compare_mask, uint64_t swap,
+                                                       uint64_t swap_mask, bool signaled,
+                                                       uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
         Emergency::abort("post masked atomic FA to non-aligned address");
 
-    ibv_exp_send_wr wr, *bad_wr;
+    ibv_exp_send_wr wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(compare);
+    sge.addr = compare.uaddr();
     sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(compare, sizeof(uint64_t));
+    sge.lkey = compare.lkey;
 
     memset(&wr, 0, sizeof(wr));
     wr.next = nullptr;
@@ -207,30 +386,40 @@ int ExtendedReliableConnection::post_masked_atomic_cas(uintptr_t dst, void *comp
         wr.exp_send_flags |= IBV_EXP_SEND_SIGNALED;
 
     wr.ext_op.masked_atomics.log_arg_sz = 3;  // log(sizeof(uint64_t))
-    wr.ext_op.masked_atomics.remote_addr = dst;
-    wr.ext_op.masked_atomics.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
+    wr.ext_op.masked_atomics.remote_addr = dst.addr;
+    wr.ext_op.masked_atomics.rkey = dst.rkey;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.compare_val =
-        *(reinterpret_cast<uint64_t *>(compare));
+        *(reinterpret_cast<uint64_t *>(compare.addr));
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.compare_mask = compare_mask;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.swap_val = swap;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.cmp_swap.swap_mask = swap_mask;
     wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[this->id];  // Must specify one
 
-    return ibv_exp_post_send(this->ini_qp, &wr, &bad_wr);
+    return this->submit(&wr);
 }
 
 int ExtendedReliableConnection::post_field_atomic_faa(uintptr_t dst, void *fetch, uint64_t add,
                                                       int highest_bit, int lowest_bit,
                                                       bool signaled, uint64_t wr_id)
 {
-    if (__glibc_unlikely((dst & 0x7) != 0))
+    return this->post_field_atomic_faa(this->peer->remote_span(dst, sizeof(uint64_t)),
+                                       this->ctx->local_span(fetch, sizeof(uint64_t)), add,
+                                       highest_bit, lowest_bit, signaled, wr_id);
+}
+
+int ExtendedReliableConnection::post_field_atomic_faa(RemoteSpan const &dst,
+                                                      LocalSpan const &fetch, uint64_t add,
+                                                      int highest_bit, int lowest_bit,
+                                                      bool signaled, uint64_t wr_id)
+{
+    if (__glibc_unlikely((dst.addr & 0x7) != 0))
         Emergency::abort("post masked atomic FA to non-aligned address");
 
-    ibv_exp_send_wr wr, *bad_wr;
+    ibv_exp_send_wr wr;
     ibv_sge sge;
-    sge.addr = reinterpret_cast<uintptr_t>(fetch);
+    sge.addr = fetch.uaddr();
     sge.length = sizeof(uint64_t);
-    sge.lkey = this->ctx->match_mr_lkey(fetch, sizeof(uint64_t));
+    sge.lkey = fetch.lkey;
 
     memset(&wr, 0, sizeof(wr));
     wr.next = nullptr;
@@ -243,17 +432,200 @@ int ExtendedReliableConnection::post_field_atomic_faa(uintptr_t dst, void *fetch
         wr.exp_send_flags |= IBV_EXP_SEND_SIGNALED;
 
     wr.ext_op.masked_atomics.log_arg_sz = 3;  // log(sizeof(uint64_t))
-    wr.ext_op.masked_atomics.remote_addr = dst;
-    wr.ext_op.masked_atomics.rkey = this->peer->match_remote_mr_rkey(dst, sizeof(uint64_t));
+    wr.ext_op.masked_atomics.remote_addr = dst.addr;
+    wr.ext_op.masked_atomics.rkey = dst.rkey;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.add_val = add << lowest_bit;
     wr.ext_op.masked_atomics.wr_data.inline_data.op.fetch_add.field_boundary = 1ull << highest_bit;
     wr.xrc_remote_srq_num = this->peer->xrc_srq_nums[this->id];  // Must specify one
 
-    return ibv_exp_post_send(this->ini_qp, &wr, &bad_wr);
+    return this->submit(&wr);
+}
+
+int ExtendedReliableConnection::post_batch_atomic_cas(uintptr_t *dst_arr, void **compare_arr,
+                                                      uint64_t *swap_arr, int count,
+                                                      uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    RemoteSpan dst[Consts::MaxPostWR];
+    LocalSpan compare[Consts::MaxPostWR];
+    for (int i = 0; i < count; ++i) {
+        dst[i] = this->peer->remote_span(dst_arr[i], sizeof(uint64_t));
+        compare[i] = this->ctx->local_span(compare_arr[i], sizeof(uint64_t));
+    }
+    return this->post_batch_atomic_cas(dst, compare, swap_arr, count, wr_id_start, signaled);
+}
+
+int ExtendedReliableConnection::post_batch_atomic_cas(RemoteSpan const *dst_arr,
+                                                      LocalSpan const *compare_arr,
+                                                      uint64_t const *swap_arr, int count,
+                                                      uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    WrChain chain;
+    for (int i = 0; i < count; ++i)
+        chain.cas(dst_arr[i], compare_arr[i], swap_arr[i],
+                  (i == count - 1 && signaled) ? IBV_EXP_SEND_SIGNALED : 0, wr_id_start + i);
+    return this->post_chain(chain);
+}
+
+int ExtendedReliableConnection::post_batch_atomic_faa(uintptr_t *dst_arr, void **fetch_arr,
+                                                      uint64_t *add_arr, int count,
+                                                      uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    RemoteSpan dst[Consts::MaxPostWR];
+    LocalSpan fetch[Consts::MaxPostWR];
+    for (int i = 0; i < count; ++i) {
+        dst[i] = this->peer->remote_span(dst_arr[i], sizeof(uint64_t));
+        fetch[i] = this->ctx->local_span(fetch_arr[i], sizeof(uint64_t));
+    }
+    return this->post_batch_atomic_faa(dst, fetch, add_arr, count, wr_id_start, signaled);
+}
+
+int ExtendedReliableConnection::post_batch_atomic_faa(RemoteSpan const *dst_arr,
+                                                      LocalSpan const *fetch_arr,
+                                                      uint64_t const *add_arr, int count,
+                                                      uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    WrChain chain;
+    for (int i = 0; i < count; ++i)
+        chain.faa(dst_arr[i], fetch_arr[i], add_arr[i],
+                  (i == count - 1 && signaled) ? IBV_EXP_SEND_SIGNALED : 0, wr_id_start + i);
+    return this->post_chain(chain);
+}
+
+int ExtendedReliableConnection::post_batch_masked_atomic_cas(uintptr_t *dst_arr, void **compare_arr,
+                                                             uint64_t *compare_mask_arr,
+                                                             uint64_t *swap_arr,
+                                                             uint64_t *swap_mask_arr, int count,
+                                                             uint64_t wr_id_start, bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    RemoteSpan dst[Consts::MaxPostWR];
+    LocalSpan compare[Consts::MaxPostWR];
+    for (int i = 0; i < count; ++i) {
+        dst[i] = this->peer->remote_span(dst_arr[i], sizeof(uint64_t));
+        compare[i] = this->ctx->local_span(compare_arr[i], sizeof(uint64_t));
+    }
+    return this->post_batch_masked_atomic_cas(dst, compare, compare_mask_arr, swap_arr,
+                                              swap_mask_arr, count, wr_id_start, signaled);
+}
+
+int ExtendedReliableConnection::post_batch_masked_atomic_cas(RemoteSpan const *dst_arr,
+                                                             LocalSpan const *compare_arr,
+                                                             uint64_t const *compare_mask_arr,
+                                                             uint64_t const *swap_arr,
+                                                             uint64_t const *swap_mask_arr,
+                                                             int count, uint64_t wr_id_start,
+                                                             bool signaled)
+{
+    if (count <= 0 || count > Consts::MaxPostWR)
+        return -1;
+
+    WrChain chain;
+    for (int i = 0; i < count; ++i)
+        chain.masked_cas(dst_arr[i], compare_arr[i], compare_mask_arr[i], swap_arr[i],
+                         swap_mask_arr[i],
+                         (i == count - 1 && signaled) ? IBV_EXP_SEND_SIGNALED : 0,
+                         wr_id_start + i);
+    return this->post_chain(chain);
+}
+
+int ExtendedReliableConnection::post_chain(WrChain &chain)
+{
+    ibv_exp_send_wr *head = chain.link();
+    if (head == nullptr)
+        return -1;
+
+    for (int i = 0; i < chain.count; ++i) {
+        int target = chain.wrs[i].exp_opcode == IBV_EXP_WR_SEND ? chain.remote_ids[i] : this->id;
+        chain.wrs[i].xrc_remote_srq_num = this->peer->xrc_srq_nums[target];
+    }
+
+    // Posting ahead of WRs that failed to flush would reorder them
+    int rc = this->flush_pending();
+    if (rc != 0)
+        return rc;
+    if (__glibc_unlikely(this->credits.enabled())) {
+        rc = this->admit(head);
+        if (rc != 0)
+            return rc;
+    }
+    ibv_exp_send_wr *bad_wr;
+    return ibv_exp_post_send(this->ini_qp, head, &bad_wr);
+}
+
+int ExtendedReliableConnection::set_deferred(bool enable, int threshold)
+{
+    int rc = this->flush_pending();
+    if (rc != 0)
+        return rc;
+    if (enable)
+        this->deferred.enable(threshold);
+    else
+        this->deferred.disable();
+    return 0;
+}
+
+int ExtendedReliableConnection::flush()
+{
+    int rc = 0;
+    if (this->deferred.size() > 0) {
+        ibv_exp_send_wr *bad_wr;
+        rc = ibv_exp_post_send(this->ini_qp, this->deferred.head(), &bad_wr);
+        if (__glibc_likely(rc == 0))
+            this->deferred.clear();
+        else
+            this->deferred.retain_from(bad_wr);  // Retried by the next flush
+    }
+    this->flush_error = rc;
+    return rc;
+}
+
+int ExtendedReliableConnection::set_managed(bool enable, int signal_every, bool blocking)
+{
+    int rc = this->flush_pending();
+    if (rc != 0)
+        return rc;
+    if (enable)
+        this->credits.enable(Consts::MaxQueueDepth, signal_every, blocking);
+    else
+        this->credits.disable();
+    return 0;
+}
+
+int ExtendedReliableConnection::admit(ibv_exp_send_wr *wr)
+{
+    int n = 0;
+    for (ibv_exp_send_wr *p = wr; p; p = p->next)
+        ++n;
+    if (n > this->credits.max_admit())
+        return EINVAL;
+
+    while (!this->credits.available(n)) {
+        // WRs covering the outstanding ones may still be pending
+        this->flush_pending();
+        if (this->credits.reclaim(this->send_cq) == 0 && !this->credits.blocking())
+            return EAGAIN;
+    }
+    this->credits.track(wr);
+    return 0;
 }
 
 int ExtendedReliableConnection::poll_send_cq(int n)
 {
+    this->flush_pending();
     ibv_wc wc_arr[32];
 
     for (int i = 0; i < n; i += 32) {
@@ -261,38 +633,31 @@ int ExtendedReliableConnection::poll_send_cq(int n)
         if (m > 32)
             m = 32;
         while (m > res) {
-            res += ibv_poll_cq(this->send_cq, m - res, wc_arr + res);
+            res += this->poll_send_raw(m - res, wc_arr + res);
         }
-        for (int j = 0; j < m; ++j)
-            if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-                Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
     }
     return n;
 }
 
 int ExtendedReliableConnection::poll_send_cq(ibv_wc *wc_arr, int n)
 {
+    this->flush_pending();
     int res = 0;
     while (n > res) {
-        res += ibv_poll_cq(this->send_cq, n - res, wc_arr + res);
+        res += this->poll_send_raw(n - res, wc_arr + res);
     }
-    for (int j = 0; j < n; ++j)
-        if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-            Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
     return res;
 }
 
 int ExtendedReliableConnection::poll_send_cq_once(ibv_wc *wc_arr, int n)
 {
-    int res = ibv_poll_cq(this->send_cq, n, wc_arr);
-    for (int j = 0; j < res; ++j)
-        if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-            Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
-    return res;
+    this->flush_pending();
+    return this->poll_send_raw(n, wc_arr);
 }
 
 int ExtendedReliableConnection::poll_recv_cq(int n)
 {
+    this->flush_pending();
     ibv_wc wc_arr[32];
 
     for (int i = 0; i < n; i += 32) {
@@ -300,32 +665,75 @@ int ExtendedReliableConnection::poll_recv_cq(int n)
         if (m > 32)
             m = 32;
         while (m > res) {
-            res += ibv_poll_cq(this->recv_cq, m - res, wc_arr + res);
+            res += this->poll_recv_raw(m - res, wc_arr + res);
         }
-        for (int j = 0; j < m; ++j)
-            if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-                Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
     }
     return n;
 }
 
 int ExtendedReliableConnection::poll_recv_cq(ibv_wc *wc_arr, int n)
 {
+    this->flush_pending();
     int res = 0;
     while (n > res)
-        res += ibv_poll_cq(this->recv_cq, n - res, wc_arr + res);
-    for (int j = 0; j < n; ++j)
-        if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-            Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
+        res += this->poll_recv_raw(n - res, wc_arr + res);
     return res;
 }
 
 int ExtendedReliableConnection::poll_recv_cq_once(ibv_wc *wc_arr, int n)
 {
-    int res = ibv_poll_cq(this->recv_cq, n, wc_arr);
+    this->flush_pending();
+    return this->poll_recv_raw(n, wc_arr);
+}
+
+int ExtendedReliableConnection::poll_send_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n)
+{
+    if (this->credits.enabled())
+        Emergency::abort("completion timestamps are not available in managed mode");
+    this->flush_pending();
+    int res = poll_cq_timestamped(this->send_cq, this->ctx->clock, wc_arr, ts_arr, n);
+    if (res > 0)
+        this->check(wc_arr, res, true);
+    return res;
+}
+
+int ExtendedReliableConnection::poll_recv_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n)
+{
+    this->flush_pending();
+    int res = poll_cq_timestamped(this->recv_cq, this->ctx->clock, wc_arr, ts_arr, n);
+    if (res > 0)
+        this->check(wc_arr, res, false);
+    return res;
+}
+
+int ExtendedReliableConnection::wait_send_cq(ibv_wc *wc_arr, int n, int spin_us, int timeout_ms)
+{
+    this->flush_pending();
+    auto poll_once = [this](ibv_wc *wc_arr, int n) { return this->poll_send_raw(n, wc_arr); };
+    return this->send_channel.wait(this->send_cq, poll_once, wc_arr, n, spin_us, timeout_ms);
+}
+
+int ExtendedReliableConnection::wait_recv_cq(ibv_wc *wc_arr, int n, int spin_us, int timeout_ms)
+{
+    this->flush_pending();
+    auto poll_once = [this](ibv_wc *wc_arr, int n) { return this->poll_recv_raw(n, wc_arr); };
+    return this->recv_channel.wait(this->recv_cq, poll_once, wc_arr, n, spin_us, timeout_ms);
+}
+
+int ExtendedReliableConnection::poll_recv_cq(RecvCompletion *rc_arr, int n)
+{
+    int res = 0;
+    while (n > res)
+        res += this->poll_recv_cq_once(rc_arr + res, n - res);
+    return res;
+}
+
+int ExtendedReliableConnection::poll_recv_cq_once(RecvCompletion *rc_arr, int n)
+{
+    ibv_wc wc_arr[32];
+    int res = this->poll_recv_cq_once(wc_arr, std::min(n, 32));
     for (int j = 0; j < res; ++j)
-        if (__glibc_unlikely(wc_arr[j].status != IBV_WC_SUCCESS))
-            Emergency::abort("wc failure: " + std::to_string(wc_arr[j].status));
+        rc_arr[j] = RecvCompletion::from(wc_arr[j]);
     return res;
 }
 
@@ -362,9 +770,15 @@ int ExtendedReliableConnection::verbose() const
     return 0;
 }
 
-int ExtendedReliableConnection::create_cq(ibv_cq **cq, int cq_depth)
+int ExtendedReliableConnection::create_cq(ibv_cq **cq, ibv_comp_channel *channel, int cq_depth)
 {
-    *cq = ibv_create_cq(this->ctx->ctx, cq_depth, nullptr, nullptr, 0);
+    ibv_exp_cq_init_attr attr;
+    memset(&attr, 0, sizeof(ibv_exp_cq_init_attr));
+    if (this->cluster->cq_timestamps) {
+        attr.comp_mask = IBV_EXP_CQ_INIT_ATTR_FLAGS;
+        attr.flags = IBV_EXP_CQ_TIMESTAMP;
+    }
+    *cq = ibv_exp_create_cq(this->ctx->ctx, cq_depth, nullptr, channel, 0, &attr);
     return errno;
 }
 
@@ -377,7 +791,7 @@ int ExtendedReliableConnection::create_srq(ibv_srq **srq, ibv_cq *cq, int srq_de
     srq_init_attr.cq = cq;
     srq_init_attr.srq_type = IBV_EXP_SRQT_XRC;
     srq_init_attr.base.attr.max_wr = srq_depth;
-    srq_init_attr.base.attr.max_sge = 16;
+    srq_init_attr.base.attr.max_sge = Consts::MaxSge;
     /**
      * `ibv_srq_attr::srq_limit`
      *
@@ -415,10 +829,15 @@ int ExtendedReliableConnection::create_qp(ibv_qp **qp, ibv_qp_type type, ibv_cq
 
     init_attr.cap.max_send_wr = qp_depth;
     init_attr.cap.max_recv_wr = qp_depth;
-    init_attr.cap.max_send_sge = 16;
-    init_attr.cap.max_recv_sge = 16;
+    init_attr.cap.max_send_sge = Consts::MaxSge;
+    init_attr.cap.max_recv_sge = Consts::MaxSge;
+    if (type == IBV_QPT_XRC)
+        init_attr.cap.max_inline_data = this->cluster->max_inline;
 
     *qp = ibv_exp_create_qp(this->ctx->ctx, &init_attr);
+    if (*qp && type == IBV_QPT_XRC)
+        this->max_inline =
+            std::min<uint32_t>(init_attr.cap.max_inline_data, Consts::MaxInlineData);
     return errno;
 }
 
@@ -432,22 +851,71 @@ void ExtendedReliableConnection::fill_exchange(OOBExchange *xchg)
     xchg->xrc_srq_num[this->id] = srq_num;
 }
 
+void ExtendedReliableConnection::recover()
+{
+    this->deferred.clear();
+    this->flush_error = 0;
+    this->credits.reset();
+
+    this->modify_to_reset();
+    this->modify_to_init();
+    this->modify_to_rtr(this->ini_qp, this->remote_gid, this->remote_lid,
+                        this->remote_tgt_qp_num);
+    this->modify_to_rtr(this->tgt_qp, this->remote_gid, this->remote_lid,
+                        this->remote_ini_qp_num);
+    this->modify_to_rts();
+    this->in_error = false;
+}
+
+void ExtendedReliableConnection::report(ibv_wc const &wc, bool send)
+{
+    CompletionError err = CompletionError::from(wc, this->peer->id, this->id, "xrc", send);
+    bool first = !this->in_error;
+    if (first) {
+        this->in_error = true;
+        this->first_error = err;
+    }
+
+    if (this->on_error)
+        this->on_error(err);
+    else if (first || wc.status != IBV_WC_WR_FLUSH_ERR)
+        err.print(this->cluster->whoami());
+}
+
 void ExtendedReliableConnection::establish(ibv_gid gid, int lid, uint32_t ini_qp_num,
                                            uint32_t tgt_qp_num)
 {
+    this->remote_gid = gid;
+    this->remote_lid = lid;
+    this->remote_ini_qp_num = ini_qp_num;
+    this->remote_tgt_qp_num = tgt_qp_num;
+
     this->modify_to_init();
     this->modify_to_rtr(this->ini_qp, gid, lid, tgt_qp_num);
     this->modify_to_rtr(this->tgt_qp, gid, lid, ini_qp_num);
     this->modify_to_rts();
 }
 
+void ExtendedReliableConnection::modify_to_reset()
+{
+    ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.qp_state = IBV_QPS_RESET;
+    if (ibv_modify_qp(ini_qp, &attr, IBV_QP_STATE))
+        Emergency::abort("modify qp failed -> reset");
+
+    if (ibv_modify_qp(tgt_qp, &attr, IBV_QP_STATE))
+        Emergency::abort("modify qp failed -> reset");
+}
+
 void ExtendedReliableConnection::modify_to_init()
 {
     ibv_qp_attr attr;
     memset(&attr, 0, sizeof(attr));
 
     attr.qp_state = IBV_QPS_INIT;
-    attr.port_num = 1;
+    attr.port_num = this->ctx->port;
     attr.pkey_index = 0;
     attr.qp_access_flags =
         IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
@@ -474,12 +942,12 @@ void ExtendedReliableConnection::modify_to_rtr(ibv_qp *qp, ibv_gid gid, int lid,
     attr.ah_attr.dlid = lid;
     attr.ah_attr.sl = 0;
     attr.ah_attr.src_path_bits = 0;
-    attr.ah_attr.port_num = 1;
+    attr.ah_attr.port_num = this->ctx->port;
     attr.ah_attr.is_global = 1;
     memcpy(&attr.ah_attr.grh.dgid, &gid, sizeof(ibv_gid));
     attr.ah_attr.grh.flow_label = 0;
     attr.ah_attr.grh.hop_limit = 1;
-    attr.ah_attr.grh.sgid_index = 1;
+    attr.ah_attr.grh.sgid_index = this->ctx->gid_index;
     attr.ah_attr.grh.traffic_class = 0;
 
     attr.max_dest_rd_atomic = 16;
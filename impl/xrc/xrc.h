@@ -2,8 +2,15 @@
 #define __XRC_H__
 
 #include "../cluster.h"
+#include "../chain.h"
+#include "../channel.h"
+#include "../completion.h"
 #include "../context.h"
+#include "../credits.h"
+#include "../deferred.h"
 #include "../peer.h"
+#include "../post.h"
+#include "../prepared.h"
 
 namespace rdma {
 
@@ -42,12 +49,146 @@ class ExtendedReliableConnection {
     int post_field_atomic_faa(uintptr_t dst, void *fetch, uint64_t add, int highest_bit = 63,
                               int lowest_bit = 0, bool signaled = false, uint64_t wr_id = 0);
 
+    // Overloads with pre-resolved keys, no MR lookup is performed
+    int post_read(LocalSpan const &dst, RemoteSpan const &src, bool signaled = false,
+                  uint64_t wr_id = 0);
+    int post_write(RemoteSpan const &dst, LocalSpan const &src, bool signaled = false,
+                   uint64_t wr_id = 0);
+    int post_send(LocalSpan const &src, int remote_id = 0, bool signaled = false,
+                  uint64_t wr_id = 0);
+    int post_recv(LocalSpan const &dst, uint64_t wr_id = 0);
+
+    // With immediate data, consuming a RECV from the SRQ of remote_id, see `ReliableConnection`
+    int post_write_imm(uintptr_t dst, void const *src, size_t size, uint32_t imm,
+                       int remote_id = 0, bool signaled = false, uint64_t wr_id = 0);
+    int post_write_imm(RemoteSpan const &dst, LocalSpan const &src, uint32_t imm,
+                       int remote_id = 0, bool signaled = false, uint64_t wr_id = 0);
+    int post_send_imm(void const *src, size_t size, uint32_t imm, int remote_id = 0,
+                      bool signaled = false, uint64_t wr_id = 0);
+    int post_send_imm(LocalSpan const &src, uint32_t imm, int remote_id = 0,
+                      bool signaled = false, uint64_t wr_id = 0);
+
+    // Scatter/gather overloads, see `ReliableConnection`
+    int post_read(LocalSpan const *dst, int count, RemoteSpan const &src, bool signaled = false,
+                  uint64_t wr_id = 0);
+    int post_write(RemoteSpan const &dst, LocalSpan const *src, int count, bool signaled = false,
+                   uint64_t wr_id = 0);
+    int post_send(LocalSpan const *src, int count, int remote_id = 0, bool signaled = false,
+                  uint64_t wr_id = 0);
+    int post_recv(LocalSpan const *dst, int count, uint64_t wr_id = 0);
+
+    int post_atomic_cas(RemoteSpan const &dst, LocalSpan const &compare, uint64_t swap,
+                        bool signaled = false, uint64_t wr_id = 0);
+    int post_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch, uint64_t add,
+                        bool signaled = false, uint64_t wr_id = 0);
+    int post_masked_atomic_cas(RemoteSpan const &dst, LocalSpan const &compare,
+                               uint64_t compare_mask, uint64_t swap, uint64_t swap_mask,
+                               bool signaled = false, uint64_t wr_id = 0);
+    int post_field_atomic_faa(RemoteSpan const &dst, LocalSpan const &fetch, uint64_t add,
+                              int highest_bit = 63, int lowest_bit = 0, bool signaled = false,
+                              uint64_t wr_id = 0);
+
+    // Work request template, SEND targets the XRC SRQ of remote_id, others that of this->id
+    PreparedOp prepare(ibv_exp_wr_opcode opcode, bool signaled = false, int remote_id = 0);
+
+    // Compile-time specialized posts inlined into the caller, see `ReliableConnection`
+    template <ibv_exp_wr_opcode Opcode, unsigned Flags = IBV_EXP_SEND_SIGNALED>
+    inline int post(RemoteSpan const &remote, LocalSpan const &local, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr wr;
+        ibv_sge sge;
+        StaticWr<Opcode, Flags>::fill(&wr, &sge, remote, local, wr_id,
+                                      this->peer->xrc_srq_nums[this->id]);
+        return this->submit(&wr);
+    }
+
+    template <ibv_exp_wr_opcode Opcode, unsigned Flags = IBV_EXP_SEND_SIGNALED>
+    inline int post(LocalSpan const &local, int remote_id = 0, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr wr;
+        ibv_sge sge;
+        StaticWr<Opcode, Flags>::fill(&wr, &sge, local, wr_id,
+                                      this->peer->xrc_srq_nums[remote_id]);
+        return this->submit(&wr);
+    }
+
+    template <ibv_exp_wr_opcode Opcode, unsigned Flags = IBV_EXP_SEND_SIGNALED>
+    inline int post_atomic(RemoteSpan const &remote, LocalSpan const &local, uint64_t compare_add,
+                           uint64_t swap = 0, uint64_t wr_id = 0)
+    {
+        ibv_exp_send_wr wr;
+        ibv_sge sge;
+        StaticWr<Opcode, Flags>::fill_atomic(&wr, &sge, remote, local, compare_add, swap, wr_id,
+                                             this->peer->xrc_srq_nums[this->id]);
+        return this->submit(&wr);
+    }
+
+    // Batched atomics, only the last one is signaled, see `ReliableConnection`
+    int post_batch_atomic_cas(uintptr_t *dst_arr, void **compare_arr, uint64_t *swap_arr,
+                              int count, uint64_t wr_id_start = 0, bool signaled = true);
+    int post_batch_atomic_faa(uintptr_t *dst_arr, void **fetch_arr, uint64_t *add_arr, int count,
+                              uint64_t wr_id_start = 0, bool signaled = true);
+    int post_batch_masked_atomic_cas(uintptr_t *dst_arr, void **compare_arr,
+                                     uint64_t *compare_mask_arr, uint64_t *swap_arr,
+                                     uint64_t *swap_mask_arr, int count, uint64_t wr_id_start = 0,
+                                     bool signaled = true);
+    int post_batch_atomic_cas(RemoteSpan const *dst_arr, LocalSpan const *compare_arr,
+                              uint64_t const *swap_arr, int count, uint64_t wr_id_start = 0,
+                              bool signaled = true);
+    int post_batch_atomic_faa(RemoteSpan const *dst_arr, LocalSpan const *fetch_arr,
+                              uint64_t const *add_arr, int count, uint64_t wr_id_start = 0,
+                              bool signaled = true);
+    int post_batch_masked_atomic_cas(RemoteSpan const *dst_arr, LocalSpan const *compare_arr,
+                                     uint64_t const *compare_mask_arr, uint64_t const *swap_arr,
+                                     uint64_t const *swap_mask_arr, int count,
+                                     uint64_t wr_id_start = 0, bool signaled = true);
+
+    // Chain of heterogeneous WRs, see `ReliableConnection::post_chain`
+    int post_chain(WrChain &chain);
+
+    // Deferred doorbell mode, see `ReliableConnection::set_deferred`
+    int set_deferred(bool enable, int threshold = Consts::MaxPostWR);
+    int flush();
+    inline int flush_status() const { return this->flush_error; }
+    inline int pending() const { return this->deferred.size(); }
+
+    // Managed send queue mode, see `ReliableConnection::set_managed`
+    int set_managed(bool enable, int signal_every = 16, bool blocking = true);
+
+    // WRITEs and SENDs of at most this many bytes are inlined, see `Cluster::set_max_inline`
+    inline uint32_t inline_threshold() const { return this->max_inline; }
+
     int poll_send_cq(int n = 1);
     int poll_send_cq(ibv_wc *wc_arr, int n = 1);
     int poll_send_cq_once(ibv_wc *wc_arr, int n = 1);
     int poll_recv_cq(int n = 1);
     int poll_recv_cq(ibv_wc *wc_arr, int n = 1);
     int poll_recv_cq_once(ibv_wc *wc_arr, int n = 1);
+    int poll_recv_cq(RecvCompletion *rc_arr, int n = 1);
+    int poll_recv_cq_once(RecvCompletion *rc_arr, int n = 1);
+
+    // Completion times stamped by the RNIC, see `ReliableConnection::poll_send_cq_timestamped`
+    int poll_send_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n = 1);
+    int poll_recv_cq_timestamped(ibv_wc *wc_arr, uint64_t *ts_arr, int n = 1);
+
+    // Spin-then-block waiting and channel fds, see `ReliableConnection::wait_send_cq`
+    int wait_send_cq(ibv_wc *wc_arr, int n = 1, int spin_us = CompletionChannel::DefaultSpinUs,
+                     int timeout_ms = -1);
+    int wait_recv_cq(ibv_wc *wc_arr, int n = 1, int spin_us = CompletionChannel::DefaultSpinUs,
+                     int timeout_ms = -1);
+    inline ibv_cq *get_send_cq() const { return this->send_cq; }
+    inline ibv_cq *get_recv_cq() const { return this->recv_cq; }
+    inline int send_cq_fd() const { return this->send_channel.fd(); }
+    inline int recv_cq_fd() const { return this->recv_channel.fd(); }
+
+    // Failed completion reporting, see `ReliableConnection::set_error_handler`
+    inline void set_error_handler(ErrorHandler handler) { this->on_error = std::move(handler); }
+    inline bool has_error() const { return this->in_error; }
+    inline CompletionError const &last_error() const { return this->first_error; }
+
+    // In-place recovery of both the initiator and the target QP, see `ReliableConnection::recover`.
+    // RECVs posted to the SRQ survive.
+    void recover();
 
     int verbose() const;
 
@@ -55,7 +196,7 @@ class ExtendedReliableConnection {
     explicit ExtendedReliableConnection(Peer &peer, int id);
     ~ExtendedReliableConnection();
 
-    int create_cq(ibv_cq **cq, int cq_depth = Consts::MaxQueueDepth);
+    int create_cq(ibv_cq **cq, ibv_comp_channel *channel, int cq_depth = Consts::MaxQueueDepth);
     int create_srq(ibv_srq **srq, ibv_cq *cq, int srq_depth = Consts::MaxQueueDepth);
     int create_qp(ibv_qp **qp, ibv_qp_type type, ibv_cq *send_cq, ibv_cq *recv_cq,
                   int qp_depth = Consts::MaxQueueDepth);
@@ -63,10 +204,65 @@ class ExtendedReliableConnection {
     void fill_exchange(OOBExchange *xchg);
     void establish(ibv_gid gid, int lid, uint32_t ini_qp_num, uint32_t tgt_qp_num);
 
+    void modify_to_reset();
     void modify_to_init();
     void modify_to_rtr(ibv_qp *qp, ibv_gid gid, int lid, uint32_t qp_num);
     void modify_to_rts();
 
+    inline int submit(ibv_exp_send_wr *wr)
+    {
+        // A failed flush may have left the chain full, retry it before appending
+        if (__glibc_unlikely(this->deferred.full())) {
+            int rc = this->flush();
+            if (rc != 0)
+                return rc;
+        }
+        if (__glibc_unlikely(this->credits.enabled())) {
+            int rc = this->admit(wr);
+            if (rc != 0)
+                return rc;
+        }
+        if (__glibc_likely(!this->deferred.enabled())) {
+            ibv_exp_send_wr *bad_wr;
+            return ibv_exp_post_send(this->ini_qp, wr, &bad_wr);
+        }
+        return this->deferred.append(wr) ? this->flush() : 0;
+    }
+
+    inline int flush_pending()
+    {
+        return __glibc_unlikely(this->deferred.size() > 0) ? this->flush() : 0;
+    }
+
+    int admit(ibv_exp_send_wr *wr);
+
+    inline int poll_send_raw(int n, ibv_wc *wc_arr)
+    {
+        int res = __glibc_unlikely(this->credits.enabled())
+                      ? this->credits.poll(this->send_cq, wc_arr, n)
+                      : ibv_poll_cq(this->send_cq, n, wc_arr);
+        if (res > 0)
+            this->check(wc_arr, res, true);
+        return res;
+    }
+
+    inline int poll_recv_raw(int n, ibv_wc *wc_arr)
+    {
+        int res = ibv_poll_cq(this->recv_cq, n, wc_arr);
+        if (res > 0)
+            this->check(wc_arr, res, false);
+        return res;
+    }
+
+    inline void check(ibv_wc const *wc_arr, int n, bool send)
+    {
+        for (int i = 0; i < n; ++i)
+            if (__glibc_unlikely(wc_arr[i].status != IBV_WC_SUCCESS))
+                this->report(wc_arr[i], send);
+    }
+
+    void report(ibv_wc const &wc, bool send);
+
     static const int InitPSN = 3185;
 
     Context *ctx;
@@ -81,6 +277,23 @@ class ExtendedReliableConnection {
     ibv_cq *send_cq;         // Initiator side CQ
     ibv_cq *recv_cq;         // Receiver (SRQ) side CQ
     ibv_cq *placeholder_cq;  // Initiator's recv & Receiver's send
+    CompletionChannel send_channel;
+    CompletionChannel recv_channel;
+    uint32_t max_inline;     // Inline capacity of the initiator
+
+    DeferredChain deferred;
+    int flush_error;  // Of the last flush
+    SendCredits credits;
+
+    // Remote end, kept for `recover`
+    ibv_gid remote_gid;
+    int remote_lid;
+    uint32_t remote_ini_qp_num;
+    uint32_t remote_tgt_qp_num;
+
+    ErrorHandler on_error;
+    bool in_error;
+    CompletionError first_error;
 };
 
 }  // namespace rdma
@@ -4,6 +4,12 @@
 #include "impl/rc/rc.h"
 #include "impl/xrc/xrc.h"
 
+#include "impl/bulk.h"
+#include "impl/dispatcher.h"
+#include "impl/hw_clock.h"
+#include "impl/multirail.h"
+#include "impl/shared_cq.h"
+
 #include "impl/rc/rptr.h"
 
 #endif  // __RDMA_H__
\ No newline at end of file
@@ -42,10 +42,11 @@ int main(int argc, char **argv)
             const int Batch = 64;
 
             auto &svr = cluster.peer(SERVER);
-            auto [dst, buf_size] = svr.remote_mr(0);
+            auto dst = svr.remote_span(0).sub(0, sizeof(uint64_t));
             auto &rc = svr.rc(0);
 
             uint64_t *local = reinterpret_cast<uint64_t *>(buf);
+            auto local_span = ctx.local_span(0);
             uint64_t cur = 0, check = 0;
 
             auto exp_start = std::chrono::steady_clock::now();
@@ -55,7 +56,10 @@ int main(int argc, char **argv)
                     int offset = (i % 2) * Batch;
                     for (int j = 0; j < Batch; ++j) {
                         local[j + offset] = cur++;
-                        rc.post_atomic_cas(dst, local + offset + j, cur, j + 1 == Batch, j);
+                        rc.post_atomic_cas(dst,
+                                           local_span.sub((offset + j) * sizeof(uint64_t),
+                                                          sizeof(uint64_t)),
+                                           cur, j + 1 == Batch, j);
                     }
                 }
 
@@ -0,0 +1,161 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../impl/mr_index.h"
+
+using namespace std;
+
+const size_t MR_SIZE = 1048576;
+const size_t MR_GAP = 65536;
+const int NLookups = 1 << 20;
+const int NRounds = 16;
+
+// The pre-index behavior: scan every MR in turn
+static bool linear_lookup(vector<pair<uintptr_t, uintptr_t>> const &mrs, uintptr_t addr,
+                          size_t size, uint32_t *key)
+{
+    for (size_t i = 0; i < mrs.size(); ++i)
+        if (addr >= mrs[i].first && addr + size <= mrs[i].second) {
+            *key = i;
+            return true;
+        }
+    return false;
+}
+
+// Nested and overlapping MRs must match whenever some MR contains the range, like the scan
+static void check_nested(mt19937_64 &rng)
+{
+    rdma::MrIndex index;
+    vector<pair<uintptr_t, uintptr_t>> mrs = {{0x1000, 0x10000},
+                                              {0x2000, 0x3000},
+                                              {0x2800, 0x4000},
+                                              {0x20000, 0x28000},
+                                              {0x24000, 0x30000}};
+    for (size_t i = 0; i < mrs.size(); ++i)
+        index.insert(mrs[i].first, mrs[i].second - mrs[i].first, i);
+
+    for (int i = 0; i < NLookups; ++i) {
+        uintptr_t addr = rng() % 0x34000;
+        size_t size = rng() % 0x2000;
+        uint32_t key, expected;
+        bool found = index.lookup(addr, size, &key);
+        if (found != linear_lookup(mrs, addr, size, &expected) ||
+            (found && (addr < mrs[key].first || addr + size > mrs[key].second))) {
+            fprintf(stderr, "nested lookup of [0x%lx, 0x%lx) mismatched\n", addr, addr + size);
+            abort();
+        }
+    }
+}
+
+// Lookups racing with registrations and removals must always find the stable MR, and replaced
+// versions must be freed once the lookups are done with them
+static void check_versions()
+{
+    const int NReaders = 4;
+    const int NUpdates = 1 << 14;
+
+    rdma::MrIndexVersions index;
+    index.insert(0x1000, MR_SIZE, 0);
+    atomic<bool> done(false);
+    vector<thread> readers;
+    for (int t = 0; t < NReaders; ++t)
+        readers.emplace_back([&] {
+            uint32_t key;
+            while (!done.load(memory_order_relaxed))
+                if (!index.lookup(0x1000 + MR_SIZE / 2, 8, &key) || key != 0)
+                    abort();
+        });
+
+    uintptr_t base = 0x10000000;
+    for (int i = 0; i < NUpdates; ++i) {
+        index.insert(base + i * MR_SIZE, MR_SIZE, i + 1);
+        if (i % 2)
+            index.erase(base + (i - 1) * MR_SIZE, MR_SIZE, i);
+    }
+    done.store(true);
+    for (auto &reader : readers)
+        reader.join();
+
+    // A burst of registrations is published as one version by the first lookup that needs it
+    for (int i = 0; i < NUpdates; ++i)
+        index.insert(base + (NUpdates + i) * MR_SIZE, MR_SIZE, NUpdates + i + 1);
+    uint32_t key;
+    if (!index.lookup(base + (2 * NUpdates - 1) * MR_SIZE, 8, &key) || key != 2 * NUpdates ||
+        index.retired_count() > 1) {
+        fprintf(stderr, "MR index versions: %lu not freed\n", index.retired_count());
+        abort();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    mt19937_64 rng(3185);
+    check_nested(rng);
+    check_versions();
+
+    for (int nmrs : {1, 4, 64, 1024}) {
+        rdma::MrIndex index;
+        rdma::MrIndexVersions versions;
+        vector<pair<uintptr_t, uintptr_t>> mrs;
+        for (int i = 0; i < nmrs; ++i) {
+            uintptr_t start = 0x10000000 + i * (MR_SIZE + MR_GAP);
+            index.insert(start, MR_SIZE, i);
+            versions.insert(start, MR_SIZE, i);
+            mrs.emplace_back(start, start + MR_SIZE);
+        }
+
+        // Random 8-byte targets in random MRs, as a stream of posts would produce
+        vector<uintptr_t> addrs(NLookups);
+        for (auto &addr : addrs)
+            addr = mrs[rng() % nmrs].first + (rng() % (MR_SIZE / 8)) * 8;
+
+        uint64_t sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < NRounds; ++r)
+            for (auto addr : addrs) {
+                uint32_t key;
+                if (!index.lookup(addr, 8, &key))
+                    abort();
+                sink += key;
+            }
+        auto end = chrono::steady_clock::now();
+        double indexed_ns = 1.0 * chrono::duration_cast<chrono::nanoseconds>(end - start).count() /
+                            (1.0 * NLookups * NRounds);
+
+        // As the post path does it: inside an epoch critical section
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < NRounds; ++r)
+            for (auto addr : addrs) {
+                uint32_t key;
+                if (!versions.lookup(addr, 8, &key))
+                    abort();
+                sink += key;
+            }
+        end = chrono::steady_clock::now();
+        double versioned_ns =
+            1.0 * chrono::duration_cast<chrono::nanoseconds>(end - start).count() /
+            (1.0 * NLookups * NRounds);
+
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < NRounds; ++r)
+            for (auto addr : addrs) {
+                uint32_t key;
+                if (!linear_lookup(mrs, addr, 8, &key))
+                    abort();
+                sink += key;
+            }
+        end = chrono::steady_clock::now();
+        double linear_ns = 1.0 * chrono::duration_cast<chrono::nanoseconds>(end - start).count() /
+                           (1.0 * NLookups * NRounds);
+
+        fprintf(stderr,
+                "%5d MRs: indexed %.2lf ns/lookup, versioned %.2lf ns/lookup, "
+                "linear %.2lf ns/lookup (%lu)\n",
+                nmrs, indexed_ns, versioned_ns, linear_ns, sink & 1);
+    }
+}
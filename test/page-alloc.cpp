@@ -0,0 +1,143 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../impl/pages.h"
+
+using namespace std;
+
+const size_t Size2M = 1ul << 21;
+
+static const char *name(rdma::PageSize page)
+{
+    switch (page) {
+    case rdma::PageSize::Default:
+        return "default";
+    case rdma::PageSize::Transparent:
+        return "transparent";
+    case rdma::PageSize::Huge2M:
+        return "2 MB";
+    case rdma::PageSize::Huge1G:
+        return "1 GB";
+    }
+    return "?";
+}
+
+static void expect(bool cond, char const *what)
+{
+    if (!cond) {
+        fprintf(stderr, "failed: %s\n", what);
+        abort();
+    }
+}
+
+// Reads the first line of a kernel setting, empty if absent
+static string read_setting(char const *path)
+{
+    char line[256] = {0};
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr)
+        return "";
+    if (fgets(line, sizeof(line), fp) == nullptr)
+        line[0] = 0;
+    fclose(fp);
+    return line;
+}
+
+// The sysfs lookup against fake device directories
+static void check_numa_lookup()
+{
+    char dir[] = "/tmp/page-alloc-XXXXXX";
+    expect(mkdtemp(dir) != nullptr, "cannot create a fake device directory");
+    string file = string(dir) + "/numa_node";
+
+    expect(rdma::numa_node_of(dir) == -1, "missing numa_node reads as -1");
+    for (auto [content, node] : {pair<char const *, int>{"1\n", 1},
+                                 {"0\n", 0},
+                                 {"-1\n", -1},
+                                 {"garbage\n", -1}}) {
+        FILE *fp = fopen(file.c_str(), "w");
+        fputs(content, fp);
+        fclose(fp);
+        expect(rdma::numa_node_of(dir) == node, content);
+    }
+    unlink(file.c_str());
+    rmdir(dir);
+}
+
+// Maps, checks the alignment of what was obtained and writes to every page
+static rdma::PageMapping check_map(size_t size, rdma::PageSize want)
+{
+    rdma::PageMapping mapping;
+    int err = rdma::map_pages(size, want, -1, &mapping);
+    expect(err == 0, "map_pages without binding");
+    expect(mapping.len >= size, "mapping covers the requested size");
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(mapping.addr);
+    if (mapping.page == rdma::PageSize::Huge1G) {
+        expect(want == rdma::PageSize::Huge1G, "1 GB pages only when asked for");
+        expect(addr % (1ul << 30) == 0 && mapping.len % (1ul << 30) == 0, "1 GB alignment");
+    }
+    if (mapping.page == rdma::PageSize::Huge2M) {
+        expect(want >= rdma::PageSize::Huge2M, "2 MB pages only when asked for");
+        expect(addr % Size2M == 0 && mapping.len % Size2M == 0, "2 MB alignment");
+    }
+    // THP over-mapping must be aligned even when THP does not back it in the end
+    if (want != rdma::PageSize::Default && mapping.page != rdma::PageSize::Huge1G)
+        expect(addr % Size2M == 0 && mapping.len % Size2M == 0, "THP range aligned to 2 MB");
+
+    memset(mapping.addr, 0x5a, mapping.len);
+    fprintf(stderr, "asked %-11s for %8zu bytes: got %-11s %8zu bytes at %p\n", name(want), size,
+            name(mapping.page), mapping.len, mapping.addr);
+    return mapping;
+}
+
+int main(int argc, char **argv)
+{
+    check_numa_lookup();
+    fprintf(stderr, "numa_node_of: fake sysfs entries read correctly\n");
+
+    string thp = read_setting("/sys/kernel/mm/transparent_hugepage/enabled");
+    string pool = read_setting("/proc/sys/vm/nr_hugepages");
+    fprintf(stderr, "THP: %s", thp.empty() ? "unavailable\n" : thp.c_str());
+    fprintf(stderr, "hugetlb 2 MB pool: %s", pool.empty() ? "unavailable\n" : pool.c_str());
+
+    const size_t Size = 3 * Size2M + 4096;
+    for (auto want : {rdma::PageSize::Default, rdma::PageSize::Transparent,
+                      rdma::PageSize::Huge2M, rdma::PageSize::Huge1G}) {
+        rdma::PageMapping mapping = check_map(Size, want);
+
+        // With THP disabled, nothing may claim to be backed by it
+        if (thp.find("[never]") != string::npos)
+            expect(mapping.page != rdma::PageSize::Transparent, "THP reported while disabled");
+        // With an empty pool, hugetlb requests must fall back
+        if (pool == "0\n")
+            expect(mapping.page != rdma::PageSize::Huge2M &&
+                       mapping.page != rdma::PageSize::Huge1G,
+                   "hugetlb reported with an empty pool");
+        munmap(mapping.addr, mapping.len);
+    }
+
+    // Binding errors are returned, with nothing left mapped
+    rdma::PageMapping mapping;
+    expect(rdma::map_pages(Size, rdma::PageSize::Transparent, 4096, &mapping) == EINVAL,
+           "binding to a node beyond the mask fails with EINVAL");
+    int err = rdma::map_pages(Size, rdma::PageSize::Transparent, 1000, &mapping);
+    expect(err != 0, "binding to a node that does not exist fails");
+    fprintf(stderr, "binding to node 1000: %s\n", strerror(err));
+
+    err = rdma::map_pages(Size, rdma::PageSize::Transparent, 0, &mapping);
+    if (err == 0) {
+        fprintf(stderr, "binding to node 0: got %s\n", name(mapping.page));
+        munmap(mapping.addr, mapping.len);
+    } else {
+        fprintf(stderr, "binding to node 0: %s\n", strerror(err));
+    }
+    fprintf(stderr, "map_pages: all checks passed\n");
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../impl/prepared.h"
+
+using namespace std;
+
+const int NPosts = 1 << 20;
+const int NRounds = 16;
+
+// Stands for the doorbell: consumes the WR so that building it is not optimized away
+__attribute__((noinline)) static uint64_t ring(ibv_exp_send_wr *wr)
+{
+    return wr->wr_id ^ wr->sg_list->addr ^ wr->wr.rdma.remote_addr ^ wr->exp_send_flags;
+}
+
+// The per-post work of `post_write(RemoteSpan const &, LocalSpan const &, ...)` up to posting
+__attribute__((noinline)) static uint64_t build_and_ring(rdma::RemoteSpan const &dst,
+                                                         rdma::LocalSpan const &src, bool signaled,
+                                                         uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
+    ibv_sge sge;
+    sge.addr = src.uaddr();
+    sge.length = src.size;
+    sge.lkey = src.lkey;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.next = nullptr;
+    wr.wr_id = wr_id;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.exp_opcode = IBV_EXP_WR_RDMA_WRITE;
+    if (signaled)
+        wr.exp_send_flags = IBV_EXP_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = dst.addr;
+    wr.wr.rdma.rkey = dst.rkey;
+    return ring(&wr);
+}
+
+int main(int argc, char **argv)
+{
+    static char local[4096];
+    rdma::LocalSpan src{local, sizeof(local), 0x1234};
+    rdma::RemoteSpan dst{0x10000000, 1ul << 20, 0x5678};
+
+    vector<uint64_t> offsets(NPosts);
+    for (int i = 0; i < NPosts; ++i)
+        offsets[i] = (i * 64ul) % (dst.size - 64);
+
+    uint64_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < NRounds; ++r)
+        for (int i = 0; i < NPosts; ++i)
+            sink += build_and_ring(dst.sub(offsets[i], 64), src.sub(0, 64), false, i);
+    auto end = chrono::steady_clock::now();
+    double build_ns = 1.0 * chrono::duration_cast<chrono::nanoseconds>(end - start).count() /
+                      (1.0 * NPosts * NRounds);
+
+    rdma::PreparedOp op(nullptr, IBV_EXP_WR_RDMA_WRITE, false);
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < NRounds; ++r)
+        for (int i = 0; i < NPosts; ++i)
+            sink += ring(op.patch(dst.sub(offsets[i], 64), src.sub(0, 64), i));
+    end = chrono::steady_clock::now();
+    double prepared_ns = 1.0 * chrono::duration_cast<chrono::nanoseconds>(end - start).count() /
+                         (1.0 * NPosts * NRounds);
+
+    fprintf(stderr, "WRITE WR setup: rebuilt %.2lf ns/post, prepared %.2lf ns/post (%lu)\n",
+            build_ns, prepared_ns, sink & 1);
+}
@@ -0,0 +1,272 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../impl/chain.h"
+#include "../impl/post.h"
+
+using namespace std;
+
+const int NPosts = 1 << 20;
+const int NRounds = 16;
+const size_t MaxInline = 64;
+
+// Stands for the doorbell: consumes the WR so that building it is not optimized away
+__attribute__((noinline)) static uint64_t ring(ibv_exp_send_wr *wr)
+{
+    return wr->wr_id ^ wr->sg_list->addr ^ wr->wr.rdma.remote_addr ^ wr->exp_send_flags;
+}
+
+// The per-post work of the runtime-dispatched `post_write(RemoteSpan const &, LocalSpan const &)`
+// before it forwarded to `StaticWr`: out-of-line, branching on the flags. Only for timing; the
+// WRs are checked against the library's `WrChain` in `check_flags`
+__attribute__((noinline)) static uint64_t runtime_post(rdma::RemoteSpan const &dst,
+                                                       rdma::LocalSpan const &src, bool signaled,
+                                                       uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
+    ibv_sge sge;
+    sge.addr = src.uaddr();
+    sge.length = src.size;
+    sge.lkey = src.lkey;
+
+    memset(&wr, 0, sizeof(wr));
+    wr.next = nullptr;
+    wr.wr_id = wr_id;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    wr.exp_opcode = IBV_EXP_WR_RDMA_WRITE;
+    if (signaled)
+        wr.exp_send_flags |= IBV_EXP_SEND_SIGNALED;
+    wr.wr.rdma.remote_addr = dst.addr;
+    wr.wr.rdma.rkey = dst.rkey;
+    if (src.size <= MaxInline)
+        wr.exp_send_flags |= IBV_EXP_SEND_INLINE;
+    return ring(&wr);
+}
+
+// The per-post work of `post<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_INLINE>`, inlined into the loop
+static inline uint64_t static_post(rdma::RemoteSpan const &dst, rdma::LocalSpan const &src,
+                                   uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
+    ibv_sge sge;
+    rdma::StaticWr<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_INLINE>::fill(&wr, &sge, dst, src, wr_id);
+    return ring(&wr);
+}
+
+// `static_post` as it was when `StaticWr` zeroed the whole WR before storing the fields it uses
+static inline uint64_t zeroed_post(rdma::RemoteSpan const &dst, rdma::LocalSpan const &src,
+                                   uint64_t wr_id)
+{
+    ibv_exp_send_wr wr;
+    ibv_sge sge;
+    memset(&wr, 0, sizeof(wr));
+    rdma::StaticWr<IBV_EXP_WR_RDMA_WRITE, IBV_EXP_SEND_INLINE>::fill(&wr, &sge, dst, src, wr_id);
+    return ring(&wr);
+}
+
+// Compares a WR built by `StaticWr` with one built by `WrChain`, the runtime builder behind
+// `post_chain` and the batched atomics, field by field: every field `ibv_exp_post_send` reads for
+// the opcode. `StaticWr` stores only those, so the others are not compared
+static void expect_same_wr(char const *what, unsigned flags, ibv_exp_send_wr const &s,
+                           ibv_sge const &s_sge, ibv_exp_send_wr const &r, ibv_sge const &r_sge)
+{
+    bool same = s.next == nullptr && s.sg_list == &s_sge && s.wr_id == r.wr_id &&
+                s.num_sge == r.num_sge && s.exp_opcode == r.exp_opcode &&
+                s.exp_send_flags == r.exp_send_flags &&
+                s.xrc_remote_srq_num == r.xrc_remote_srq_num && s.comp_mask == r.comp_mask &&
+                s_sge.addr == r_sge.addr && s_sge.length == r_sge.length &&
+                s_sge.lkey == r_sge.lkey;
+
+    switch (s.exp_opcode) {
+    case IBV_EXP_WR_RDMA_READ:
+    case IBV_EXP_WR_RDMA_WRITE:
+        same = same && s.wr.rdma.remote_addr == r.wr.rdma.remote_addr &&
+               s.wr.rdma.rkey == r.wr.rdma.rkey;
+        break;
+    case IBV_EXP_WR_ATOMIC_CMP_AND_SWP:
+        same = same && s.wr.atomic.swap == r.wr.atomic.swap;
+        // Fall through
+    case IBV_EXP_WR_ATOMIC_FETCH_AND_ADD:
+        same = same && s.wr.atomic.remote_addr == r.wr.atomic.remote_addr &&
+               s.wr.atomic.rkey == r.wr.atomic.rkey &&
+               s.wr.atomic.compare_add == r.wr.atomic.compare_add;
+        break;
+    default:
+        break;
+    }
+
+    if (!same) {
+        fprintf(stderr, "%s (flags 0x%x): StaticWr and WrChain build different WRs\n", what,
+                flags);
+        abort();
+    }
+}
+
+// Checks every opcode of `StaticWr` with a given flag combination
+template <unsigned Flags>
+static void check_flags(rdma::RemoteSpan const &dst, rdma::LocalSpan const &src)
+{
+    const uint64_t WrId = 0x1234567890ul, Swap = 0xabcdef, Add = 42;
+    ibv_exp_send_wr wr;
+    ibv_sge sge;
+    rdma::WrChain chain;
+    uint64_t compare = *reinterpret_cast<uint64_t *>(src.addr);
+
+    // Garbage everywhere first, so that a field `StaticWr` forgets to store shows up
+    auto poison = [&] { memset(&wr, 0xa5, sizeof(wr)); };
+
+    if constexpr (!(Flags & IBV_EXP_SEND_INLINE)) {
+        poison();
+        rdma::StaticWr<IBV_EXP_WR_RDMA_READ, Flags>::fill(&wr, &sge, dst, src, WrId);
+        chain.clear();
+        chain.read(src, dst, Flags, WrId);
+        expect_same_wr("READ", Flags, wr, sge, chain.wr_at(0), chain.sge_at(0));
+
+        poison();
+        rdma::StaticWr<IBV_EXP_WR_ATOMIC_CMP_AND_SWP, Flags>::fill_atomic(
+            &wr, &sge, dst.sub(0, 8), src.sub(0, 8), compare, Swap, WrId);
+        chain.clear();
+        chain.cas(dst.sub(0, 8), src.sub(0, 8), Swap, Flags, WrId);
+        expect_same_wr("CAS", Flags, wr, sge, chain.wr_at(0), chain.sge_at(0));
+
+        poison();
+        rdma::StaticWr<IBV_EXP_WR_ATOMIC_FETCH_AND_ADD, Flags>::fill_atomic(
+            &wr, &sge, dst.sub(0, 8), src.sub(0, 8), Add, 0, WrId);
+        chain.clear();
+        chain.faa(dst.sub(0, 8), src.sub(0, 8), Add, Flags, WrId);
+        expect_same_wr("FAA", Flags, wr, sge, chain.wr_at(0), chain.sge_at(0));
+    }
+
+    poison();
+    rdma::StaticWr<IBV_EXP_WR_RDMA_WRITE, Flags>::fill(&wr, &sge, dst, src, WrId);
+    chain.clear();
+    chain.write(dst, src, Flags, WrId);
+    expect_same_wr("WRITE", Flags, wr, sge, chain.wr_at(0), chain.sge_at(0));
+
+    poison();
+    rdma::StaticWr<IBV_EXP_WR_SEND, Flags>::fill(&wr, &sge, src, WrId);
+    chain.clear();
+    chain.send(src, Flags, WrId);
+    expect_same_wr("SEND", Flags, wr, sge, chain.wr_at(0), chain.sge_at(0));
+}
+
+template <unsigned... Flags>
+static void check_all(rdma::RemoteSpan const &dst, rdma::LocalSpan const &src)
+{
+    (check_flags<Flags>(dst, src), ...);
+}
+
+// Counts retired user-space instructions, or returns -1 if hardware counters are unavailable
+class InstrCounter {
+  public:
+    InstrCounter()
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        this->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~InstrCounter()
+    {
+        if (this->fd >= 0)
+            close(this->fd);
+    }
+
+    void start()
+    {
+        if (this->fd >= 0) {
+            ioctl(this->fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    long long stop()
+    {
+        long long count = -1;
+        if (this->fd >= 0) {
+            ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(this->fd, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        }
+        return count;
+    }
+
+  private:
+    int fd;
+};
+
+int main(int argc, char **argv)
+{
+    static char local[4096];
+    rdma::LocalSpan src{local, sizeof(local), 0x1234};
+    rdma::RemoteSpan dst{0x10000000, 1ul << 20, 0x5678};
+
+    // Equivalence first: every opcode with every combination of the supported flags
+    *reinterpret_cast<uint64_t *>(local) = 0x5a5a5a5a;
+    const unsigned S = IBV_EXP_SEND_SIGNALED, F = IBV_EXP_SEND_FENCE, I = IBV_EXP_SEND_INLINE;
+    check_all<0, S, F, I, S | F, S | I, F | I, S | F | I>(dst.sub(64, 64), src.sub(0, 64));
+    fprintf(stderr, "StaticWr: WRs match WrChain for all opcodes and flags\n");
+
+    // Then timing
+    vector<uint64_t> offsets(NPosts);
+    for (int i = 0; i < NPosts; ++i)
+        offsets[i] = (i * 64ul) % (dst.size - 64);
+
+    InstrCounter counter;
+    uint64_t sink = 0;
+    double total = 1.0 * NPosts * NRounds;
+
+    counter.start();
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < NRounds; ++r)
+        for (int i = 0; i < NPosts; ++i)
+            sink += runtime_post(dst.sub(offsets[i], 64), src.sub(0, 64), false, i);
+    auto end = chrono::steady_clock::now();
+    long long runtime_instr = counter.stop();
+    double runtime_ns =
+        chrono::duration_cast<chrono::nanoseconds>(end - start).count() / total;
+
+    counter.start();
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < NRounds; ++r)
+        for (int i = 0; i < NPosts; ++i)
+            sink += zeroed_post(dst.sub(offsets[i], 64), src.sub(0, 64), i);
+    end = chrono::steady_clock::now();
+    long long zeroed_instr = counter.stop();
+    double zeroed_ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / total;
+
+    counter.start();
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < NRounds; ++r)
+        for (int i = 0; i < NPosts; ++i)
+            sink += static_post(dst.sub(offsets[i], 64), src.sub(0, 64), i);
+    end = chrono::steady_clock::now();
+    long long static_instr = counter.stop();
+    double static_ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / total;
+
+    fprintf(stderr,
+            "WRITE post: runtime %.2lf ns/post, static zeroed %.2lf ns/post, static %.2lf ns/post "
+            "(%lu)\n",
+            runtime_ns, zeroed_ns, static_ns, sink & 1);
+    if (runtime_instr >= 0 && zeroed_instr >= 0 && static_instr >= 0)
+        fprintf(stderr,
+                "WRITE post: runtime %.1lf instr/post, static zeroed %.1lf instr/post, static "
+                "%.1lf instr/post\n",
+                runtime_instr / total, zeroed_instr / total, static_instr / total);
+    else
+        fprintf(stderr, "WRITE post: instruction counter unavailable\n");
+}